@@ -5,8 +5,10 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 //////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>      // std::min(), std::max()
 #include <pthread.h>
 #include <fstream>        // for reading meminfo
+#include <string.h>       // memset()
 
 #include "umap/Buffer.hpp"
 #include "umap/config.h"
@@ -22,14 +24,41 @@ namespace Umap {
 //
 void Buffer::mark_page_as_present(PageDescriptor* pd)
 {
-  lock();
+  BufferShard* s = shard_of(pd->page);
 
+  //
+  // Start tracking accesses to a newly filled page.  The page belongs to the
+  // filler until it is marked present, so this is done before taking the
+  // shard lock.
+  //
+  if ( m_idle_tracker && pd->state == PageDescriptor::State::FILLING )
+    m_idle_tracker->mark_idle(pd->page);
+
+  s->lock();
+
+  pd->data_present = true;
+  pd->set_state_present();
+
+  s->wake_waiters(pd);
+
+  s->unlock();
+}
+
+//
+// Called after a dirty page has been written back to its store and is
+// write protected again
+//
+void Buffer::mark_page_as_flushed( PageDescriptor* pd )
+{
+  BufferShard* s = shard_of(pd->page);
+  s->lock();
+
+  mark_clean(pd);
   pd->set_state_present();
 
-  if ( m_waits_for_state_change )
-    pthread_cond_broadcast( &m_state_change_cond );
+  s->wake_waiters(pd);
 
-  unlock();
+  s->unlock();
 }
 
 //
@@ -37,39 +66,196 @@ void Buffer::mark_page_as_present(PageDescriptor* pd)
 //
 void Buffer::mark_page_as_free( PageDescriptor* pd )
 {
-  lock();
+  BufferShard* s = shard_of(pd->page);
+  s->lock();
 
   UMAP_LOG(Debug, "Removing page: " << pd);
   pd->region->erase_page_descriptor(pd);
 
-  m_present_pages.erase(pd->page);
-
   pd->set_state_free();
+  mark_clean(pd);
   pd->spurious_count = 0;
+  pd->pinned = false;
+  pd->page = nullptr;
+
+  s->wake_waiters(pd);
 
   //
-  // We only put the page descriptor back onto the free list if it isn't
-  // deferred.  Note: It will be marked as deferred when the page is part of a
-  // Region that has been unmapped.  It will become undeferred later when the
-  // eviction manager takes it off the end of the end of the buffer.
+  // A retired descriptor may be freed as soon as it is released
   //
-  if ( ! pd->deferred )
-    release_page_descriptor(pd);
+  release_page_descriptor(s, pd);
 
-  if ( m_waits_for_state_change )
-    pthread_cond_broadcast( &m_state_change_cond );
+  s->unlock();
+}
 
-  pd->page = nullptr;
+void Buffer::release_page_descriptor( BufferShard* s, PageDescriptor* pd )
+{
+  //
+  // Descriptors released while the buffer is shrinking are retired instead
+  // of being made available again.
+  //
+  uint64_t retiring = m_num_retiring;
+  while ( retiring && ! m_num_retiring.compare_exchange_weak(retiring, retiring - 1) )
+    ;
+
+  if ( retiring ) {
+    m_pool.put(pd);
+    return;
+  }
 
-  unlock();
+  s->m_free_pages.push_back(pd);
+  ++m_num_free;
+  page_descriptors_made_available();
 }
 
-void Buffer::release_page_descriptor( PageDescriptor* pd )
+//
+// Wakes whoever is waiting for a page descriptor: threads asleep in
+// wait_for_available_page_descriptor(), and handlers holding faults back
+// until there is one.  Handlers read the generation after saying they are
+// waiting, so one of the two always sees the other.  Writes held back
+// while too many pages were dirty are woken the same way once there are
+// fewer.
+//
+void Buffer::page_descriptors_made_available( void )
 {
-    m_free_pages.push_back(pd);
+  ++m_avail_pd_generation;
+
+  if ( m_waits_for_avail_pd ) {
+    pthread_mutex_lock(&m_avail_pd_mutex);
+    pthread_cond_broadcast(&m_avail_pd_cond);
+    pthread_mutex_unlock(&m_avail_pd_mutex);
+  }
+
+  Uffd* uffd = m_rm.get_uffd_h();
+  if ( uffd != nullptr )
+    uffd->page_descriptors_available();
+}
+
+//
+// Called with s locked when its free list is empty.  Takes a batch of new
+// descriptors from the pool if the buffer has not yet grown to its size.
+//
+bool Buffer::allocate_page_descriptors( BufferShard* s )
+{
+  const uint64_t batch = 64;
+  uint64_t unallocated = m_num_unallocated;
+  uint64_t n;
+
+  do {
+    n = std::min(unallocated, batch);
+    if ( n == 0 )
+      return false;
+  } while ( ! m_num_unallocated.compare_exchange_weak(unallocated, unallocated - n) );
+
+  m_pool.get(n, s->m_free_pages);
+  m_num_free += n;
+  return true;
+}
+
+//
+// Called with s locked when its free list is empty.  Moves up to half of the
+// free descriptors of another shard onto s.  Other shards are only try-locked
+// so that two shards stealing from one another cannot deadlock.
+//
+bool Buffer::steal_page_descriptors( BufferShard* s )
+{
+  uint64_t me = s - m_shards;
+
+  for ( uint64_t i = 1; i < m_num_shards && m_num_free; ++i ) {
+    BufferShard* victim = &m_shards[(me + i) % m_num_shards];
+
+    if ( ! victim->trylock() )
+      continue;
+
+    std::size_t n = (victim->m_free_pages.size() + 1) / 2;
+    for ( ; n; --n ) {
+      s->m_free_pages.push_back(victim->m_free_pages.back());
+      victim->m_free_pages.pop_back();
+    }
+
+    victim->unlock();
+
+    if ( s->m_free_pages.size() )
+      return true;
+  }
+  return false;
+}
+
+//
+// Called with s locked.  Returns true if s has a free page descriptor,
+// taking or stealing some if it has to, without giving up the lock.
+//
+bool Buffer::page_descriptor_available( BufferShard* s )
+{
+  return    s->m_free_pages.size()
+         || allocate_page_descriptors(s)
+         || steal_page_descriptors(s);
+}
+
+//
+// Called without any shard lock held, after s failed to find a descriptor.
+// There may still be free descriptors on shards that were busy when s only
+// try-locked them, so every shard is looked at again, this time waiting
+// for its lock since no other is held.  Returns true if s has a free
+// descriptor.
+//
+bool Buffer::take_available_page_descriptors( BufferShard* s )
+{
+  uint64_t me = s - m_shards;
+  std::vector<PageDescriptor*> pages;
+
+  for ( uint64_t i = 0; i < m_num_shards && m_num_free; ++i ) {
+    BufferShard* victim = &m_shards[(me + i) % m_num_shards];
+
+    victim->lock();
+    if ( victim == s && s->m_free_pages.size() ) {
+      s->unlock();
+      return true;
+    }
+
+    for ( std::size_t n = (victim->m_free_pages.size() + 1) / 2; n; --n ) {
+      pages.push_back(victim->m_free_pages.back());
+      victim->m_free_pages.pop_back();
+    }
+    victim->unlock();
+
+    if ( pages.size() ) {
+      s->lock();
+      s->m_free_pages.insert(s->m_free_pages.end(), pages.begin(), pages.end());
+      s->unlock();
+      return true;
+    }
+  }
 
-    if ( m_waits_for_avail_pd )
-      pthread_cond_broadcast(&m_avail_pd_cond);
+  return false;
+}
+
+//
+// Only once every shard has turned up nothing, and nothing has been made
+// available since, is it time to sleep.  Just checking for a free
+// descriptor anywhere would spin, since it may already have been claimed
+// by a thread that has yet to run.
+//
+void Buffer::wait_for_available_page_descriptor( BufferShard* s )
+{
+  while ( 1 ) {
+    uint64_t generation = m_avail_pd_generation;
+
+    if ( take_available_page_descriptors(s) )
+      return;
+
+    pthread_mutex_lock(&m_avail_pd_mutex);
+    ++m_waits_for_avail_pd;
+
+    while ( m_avail_pd_generation == generation && m_num_unallocated == 0 )
+      pthread_cond_wait(&m_avail_pd_cond, &m_avail_pd_mutex);
+
+    --m_waits_for_avail_pd;
+    pthread_mutex_unlock(&m_avail_pd_mutex);
+
+    if ( m_num_unallocated )
+      return;
+  }
 }
 
 //
@@ -78,107 +264,188 @@ void Buffer::release_page_descriptor( PageDescriptor* pd )
 //
 PageDescriptor* Buffer::evict_oldest_page()
 {
-  PageDescriptor* pd = nullptr;
+  std::vector<PageDescriptor*> victims;
 
-  lock();
+  for ( uint64_t i = 0; i < m_num_shards; ++i ) {
+    BufferShard* s = &m_shards[i];
 
-  while ( m_busy_pages.size() != 0 ) {
-    pd = m_busy_pages.back();
+    PageDescriptor* pd = nullptr;
 
-    // Deferred means that this page was previously evicted as part of an
-    // uunmap of a Region.  This means that this page descriptor points to a
-    // page that has already been given back to the system so all we need to
-    // do is take it off of the busy list and release the descriptor.
-    //
-    if ( pd->deferred ) {
-      UMAP_LOG(Debug, "Deferred Page: " << pd);
+    s->lock();
+    s->m_policy->select_victims(1, [](PageDescriptor*) { return true; }, victims);
 
+    if ( victims.size() ) {
+      pd = victims.back();
+      --m_num_busy;
+    }
+    else if ( s->m_pinned_pages.size() ) {
       //
-      // Make sure that the page has truly been flushed.
+      // Pinned pages are only evicted once everything else is gone
       //
-      wait_for_page_state(pd, PageDescriptor::State::FREE);
+      pd = s->m_pinned_pages.back();
+      drop_pin(s, pd);
+    }
 
-      m_busy_pages.pop_back();
-      m_stats.pages_deleted++;
+    if ( pd != nullptr ) {
+      s->m_stats.pages_deleted++;
 
-      //
-      // Jump to the next page descriptor
-      //
-      release_page_descriptor(pd);
-      pd = nullptr;
-    }
-    else {
       UMAP_LOG(Debug, "Normal Page: " << pd);
-      wait_for_page_state(pd, PageDescriptor::State::PRESENT);
-      m_busy_pages.pop_back();
-      m_stats.pages_deleted++;
+      wait_for_page_state(s, pd, PageDescriptor::State::PRESENT);
       pd->set_state_leaving();
-      break;
+
+      s->unlock();
+      return pd;
     }
+
+    s->unlock();
   }
 
-  unlock();
-  return pd;
+  return nullptr;
 }
 
 //
-// Called from Evict Manager to begin eviction process on at most N (=32)
-// oldest present (non-deferred) pages without waiting for status change
+// Called from Evict Manager to begin eviction process on at most N (=32, or
+// one per shard if there are more) present pages, as chosen by the eviction
+// policy, without waiting for status change.  Neighbouring pages are in
+// different shards, so an even share of the pages is taken from every
+// shard, that the pages can be written back and released in runs.  Shards
+// are visited round-robin so that a share that does not divide evenly is
+// spread across the buffer.
 //
 std::vector<PageDescriptor*> Buffer::evict_oldest_pages()
 {
   std::vector<PageDescriptor*> evicted_pages;
-  std::vector<PageDescriptor*> pending_pages;
-  const int max_num_evicted_pages = 32;
-  int num_evicted_pages = 0;
-
-  lock();
-  size_t num_busy_pages = m_busy_pages.size();
-  if( num_busy_pages>0 ){
-    size_t i = num_busy_pages - 1;
-    for(; (i>=0 && num_evicted_pages<max_num_evicted_pages); i--){
-        PageDescriptor* pd = m_busy_pages[i];
-        if( !pd->deferred && pd->state == PageDescriptor::State::PRESENT ){
-          m_stats.pages_deleted++;
-          num_evicted_pages ++;
-
-          pd->state = PageDescriptor::State::LEAVING;
-          evicted_pages.push_back(pd);
-        }else{
-          pending_pages.push_back(pd);
-        }
-        m_busy_pages.pop_back();
+  const std::size_t max_num_evicted_pages = std::max((uint64_t)32, m_num_shards);
+  const std::size_t per_shard = (max_num_evicted_pages + m_num_shards - 1) / m_num_shards;
+
+  auto present = [](PageDescriptor* pd) {
+    return pd->state == PageDescriptor::State::PRESENT;
+  };
+
+  for (   uint64_t n = 0
+        ; n < m_num_shards && evicted_pages.size() < max_num_evicted_pages
+        ; ++n ) {
+    BufferShard* s = &m_shards[m_evict_cursor++ % m_num_shards];
+    std::size_t first = evicted_pages.size();
+    std::size_t max = std::min(per_shard, max_num_evicted_pages - first);
+    std::vector<char*> accessed;
+
+    //
+    // Reading the accessed bits takes system calls, so it is done without
+    // the shard lock held
+    //
+    if ( m_idle_tracker ) {
+      s->lock();
+      s->m_policy->pages_to_sample(max, accessed);
+      s->unlock();
+
+      m_idle_tracker->test_and_clear_young(accessed);
     }
 
-    size_t num_pending_pages = pending_pages.size();
-    for(size_t k=0; k<num_pending_pages; k++){
-      m_busy_pages.push_back(pending_pages[k]);
+    s->lock();
+    if ( accessed.size() )
+      s->m_policy->sampled(max, accessed);
+    s->m_policy->select_victims(max, present, evicted_pages);
+
+    for ( std::size_t i = first; i < evicted_pages.size(); ++i ) {
+      --m_num_busy;
+      s->m_stats.pages_deleted++;
+      evicted_pages[i]->set_state_leaving();
     }
+    s->unlock();
   }
-  unlock();
 
   return evicted_pages;
 }
 
-  void Buffer::flush_dirty_pages()
-  {
-    lock();
+//
+// Write every dirty page back to its store.  Pages being flushed are held in
+// the UPDATING state so that they are neither evicted nor modified while the
+// Evict Workers write them out.
+//
+void Buffer::flush_dirty_pages()
+{
+  std::vector<PageDescriptor*> flushes;
+
+  for ( uint64_t i = 0; i < m_num_shards; ++i ) {
+    BufferShard* s = &m_shards[i];
+    bool rescan = true;
+
+    s->lock();
+    while ( rescan ) {
+      std::vector<PageDescriptor*> busy_pages;
+
+      rescan = false;
+      s->m_policy->pages(busy_pages);
+      s->m_pinned_pages.pages(busy_pages);
+
+      for ( auto pd : busy_pages ) {
+        if ( ! pd->dirty )
+          continue;
+
+        if ( pd->state != PageDescriptor::State::PRESENT ) {
+          //
+          // Waiting drops the shard lock, so the busy pages must be rescanned.
+          // The page may be evicted rather than become present again, so
+          // only wait for the next state change.  The rescan finds the pages
+          // we have already taken still dirty and UPDATING, so they are sent
+          // to the Evict Workers first, or we could end up waiting for them.
+          //
+          m_rm.get_evict_manager()->schedule_flushes(flushes);
+          flushes.clear();
+          s->wait_for_change(pd);
+          rescan = true;
+          break;
+        }
 
-    for (auto it = m_busy_pages.begin(); it != m_busy_pages.end(); it++) {
-      
-      if ( (*it)->dirty ) {
-        PageDescriptor* pd = *it;
         UMAP_LOG(Debug, "schedule Dirty Page: " << pd);
-        wait_for_page_state(pd, PageDescriptor::State::PRESENT);
-        m_rm.get_evict_manager()->schedule_flush(pd);
+        pd->set_state_updating();
+        flushes.push_back(pd);
       }
     }
+    s->unlock();
+  }
 
-    m_rm.get_evict_manager()->WaitAll();
-    
-    unlock();
+  //
+  // Neighbouring pages are in different shards, so the pages of every shard
+  // are written together
+  //
+  m_rm.get_evict_manager()->schedule_flushes(flushes);
+
+  //
+  // Pages the Evict Manager has chosen are out of the policy, but may not
+  // have been handed to the Evict Workers yet, so its pass has to end before
+  // waiting for the workers is enough for their data to be in the store
+  //
+  m_rm.get_evict_manager()->wait_for_idle();
+  m_rm.get_evict_manager()->WaitAll();
+}
+
+//
+// With asynchronous write protection, pages are only known to be dirty once
+// the page table has been scanned for them.  Marks the pages of rd written
+// since the last scan as dirty, write protecting them again with protect.
+//
+void Buffer::harvest_written_pages( RegionDescriptor* rd, bool protect )
+{
+  std::vector<char*> pages;
+
+  if ( ! rd->writable() )
+    return;
+
+  m_rm.get_uffd_h()->scan_written_pages(rd, protect, pages);
+
+  for ( auto paddr : pages ) {
+    BufferShard* s = shard_of(paddr);
+
+    s->lock();
+    auto pd = rd->get_page_descriptor(paddr);
+    if ( pd != nullptr )
+      mark_dirty(pd);
+    s->unlock();
   }
-  
+}
+
 //
 // Called from uunmap by the unmapping thread of the application
 //
@@ -187,67 +454,406 @@ std::vector<PageDescriptor*> Buffer::evict_oldest_pages()
 //
 void Buffer::evict_region(RegionDescriptor* rd)
 {
-  if (m_rm.get_num_active_regions() > 1) {
-    lock();
-    while ( rd->count() ) {
-      auto pd = rd->get_next_page_descriptor();
-      if(pd->state != PageDescriptor::State::LEAVING ){
-        pd->deferred = true;
-        wait_for_page_state(pd, PageDescriptor::State::PRESENT);
-        pd->set_state_leaving();
-        m_rm.get_evict_manager()->schedule_eviction(pd);
-      }
-      wait_for_page_state(pd, PageDescriptor::State::FREE);
-    }
-    unlock();
-  }
-  else {
+  bool wp_async = m_rm.get_uffd_h()->wp_async();
+
+  //
+  // Background writeback looks its pages up again through their regions,
+  // so none may be under way while rd goes, nor start until its pages are
+  // gone
+  //
+  pthread_mutex_lock(&m_writeback_mutex);
+
+  //
+  // The application no longer writes to the region, so the pages written
+  // are all known after one scan and only those need to be written back
+  //
+  if ( wp_async )
+    harvest_written_pages(rd, false);
+
+  //
+  // Pages that the Evict Manager has already chosen may not have reached
+  // the Evict Workers yet, so the walk of the page table below still has to
+  // wait for them after everything else is gone.
+  //
+  if (m_rm.get_num_active_regions() == 1)
     m_rm.get_evict_manager()->EvictAll();
+
+  //
+  // Walk the page table in address order, stopping as soon as the last
+  // resident page of the region has been evicted.
+  //
+  for ( uint64_t i = 0; i < rd->num_pages() && rd->count(); ++i ) {
+    char* paddr = rd->start() + i * m_page_size;
+
+    if ( rd->get_page_descriptor(paddr) == nullptr )
+      continue;
+
+    BufferShard* s = shard_of(paddr);
+    s->lock();
+
+    //
+    // The page may have been freed before we got the shard lock
+    //
+    auto pd = rd->get_page_descriptor(paddr);
+    if ( pd == nullptr ) {
+      s->unlock();
+      continue;
+    }
+
+    //
+    // Taking the page away from the eviction policy keeps the Evict
+    // Manager from choosing it while we wait for it to settle.  If the
+    // policy no longer has it, an eviction is already under way.
+    //
+    bool evict = false;
+
+    if ( s->m_policy->remove(pd) ) {
+      --m_num_busy;
+      evict = true;
+    }
+    else if ( pd->pinned ) {
+      drop_pin(s, pd);
+      evict = true;
+    }
+
+    if ( evict ) {
+      s->m_stats.pages_deleted++;
+
+      wait_for_page_state(s, pd, PageDescriptor::State::PRESENT);
+      pd->set_state_leaving();
+      m_rm.get_evict_manager()->schedule_eviction(pd, wp_async);
+    }
+
+    //
+    // A descriptor is released, and may be reused or even given back to
+    // the pool, as soon as it is freed.  So wait for it to leave the page
+    // table rather than looking at the descriptor itself.
+    //
+    while ( rd->get_page_descriptor(paddr) == pd )
+      s->wait_for_change(pd);
+    s->unlock();
   }
+
+  pthread_mutex_unlock(&m_writeback_mutex);
 }
 
 bool Buffer::low_threshold_reached( void )
 {
-  return m_busy_pages.size() <= m_evict_low_water;
+  return m_num_busy <= m_evict_low_water;
+}
+
+//
+// Called by the Evict Manager once the low water mark is reached, so that
+// the next crossing of the high water mark starts it again
+//
+void Buffer::evict_pass_done( void )
+{
+  m_evict_kicked = false;
+
+  if ( m_num_busy >= m_evict_high_water && ! low_threshold_reached() )
+    kick_evict_manager();
 }
 
 typedef struct FetchFuncParams {
   uint64_t psize;
-  RegionDescriptor* rd;
+  Buffer* buffer;
   Uffd* m_uffd;
-  uint64_t offset_st;
-  uint64_t offset_end;
+  PageDescriptor** pages;
+  uint64_t num_pages;
 } FetchFuncParams;
 
 void *FetchFunc(void *arg) 
 { 
   FetchFuncParams* params = (FetchFuncParams*) arg;
   uint64_t psize = params->psize;
-  RegionDescriptor* rd = params->rd;
   Uffd* m_uffd = params->m_uffd;
-  char* region_st = rd->start();
-  uint64_t offset_st = params->offset_st;
-  uint64_t offset_end= params->offset_end;
+  const uint64_t max_run = std::max((uint64_t)1, (uint64_t)(1 << 20) / psize);
 
-  char* copyin_buf = (char*) malloc(psize);
+  char* copyin_buf = (char*) malloc(max_run * psize);
   if ( !copyin_buf )
     UMAP_ERROR("Failed to allocate copyin_buf");
   
-  for(uint64_t offset = offset_st; offset < offset_end; offset+=psize){
-    
-    if( rd->store()->read_from_store(copyin_buf, psize, offset) == -1)
-      UMAP_ERROR("failed to read_from_store at offset="<<offset);
-  
-    m_uffd->copy_in_page(copyin_buf, region_st + offset );
+  //
+  // The pages are in address order, so runs of neighbouring pages are
+  // copied in all at once, and the threads that faulted on them woken
+  // together once they are present.  The runs of a region that fit in
+  // copyin_buf are read from its store as one batch, which the store may
+  // merge or do concurrently.
+  //
+  std::vector<Umap::StoreRequest> reads;
+  std::vector<uint64_t> firsts;
+
+  for ( uint64_t i = 0; i < params->num_pages; ) {
+    RegionDescriptor* rd = params->pages[i]->region;
+    uint64_t batched = 0;
+
+    reads.clear();
+    firsts.clear();
+
+    while ( i < params->num_pages && params->pages[i]->region == rd && batched < max_run ) {
+      PageDescriptor* pd = params->pages[i];
+      uint64_t n = 1;
+
+      while (    i + n < params->num_pages && batched + n < max_run
+              && params->pages[i + n]->region == rd
+              && params->pages[i + n]->page == pd->page + n * psize
+              && rd->uffd_handler_of(params->pages[i + n]->page) == rd->uffd_handler_of(pd->page) )
+        ++n;
+
+      reads.push_back({   copyin_buf + batched * psize
+                        , n * psize
+                        , (off_t)rd->store_offset(pd->page)
+                        , 0 });
+      firsts.push_back(i);
+      batched += n;
+      i += n;
+    }
+
+    rd->store()->read_from_store_v(reads.data(), reads.size());
+
+    for ( uint64_t r = 0; r < reads.size(); ++r ) {
+      Umap::StoreRequest& req = reads[r];
+      PageDescriptor** pages = &params->pages[firsts[r]];
+      uint64_t n = req.nb / psize;
+
+      if( req.result == -1)
+        UMAP_ERROR("failed to read_from_store at offset="<<req.off);
+
+      if ( (uint64_t)req.result < req.nb )
+        memset(req.buf + req.result, 0, req.nb - req.result);
+
+      m_uffd->copy_in_pages_and_write_protect(rd, req.buf, pages[0]->page, n);
+
+      for ( uint64_t j = 0; j < n; ++j )
+        params->buffer->mark_page_as_present(pages[j]);
+
+      m_uffd->wake_up(rd, pages[0]->page, n);
+    }
   }
 
   free(copyin_buf);
   return NULL;
 } 
 
+//
+// Read the given pages in from their stores, in parallel when there are
+// many of them
+//
+void Buffer::fetch_pages( std::vector<PageDescriptor*>& pages )
+{
+  Uffd* m_uffd = m_rm.get_uffd_h();
+  size_t num_pages = pages.size();
+  size_t num_fetch_threads = (num_pages>1024) ?8 : 1;
+  size_t stride = num_pages/num_fetch_threads;
+
+  if ( num_pages == 0 )
+    return;
+
+  pthread_t fetchThreads[num_fetch_threads];
+  FetchFuncParams params[num_fetch_threads];
+  for(size_t i=0; i<num_fetch_threads; i++){
+    params[i].psize = m_page_size;
+    params[i].buffer = this;
+    params[i].m_uffd = m_uffd;
+    params[i].pages = &pages[stride*i];
+    params[i].num_pages = stride;
+    if(i==(num_fetch_threads-1))
+      params[i].num_pages = num_pages - stride*i;
+    UMAP_LOG(Debug, "FetchThread "<<i<<" "<<params[i].num_pages<<" pages");
+      
+    int ret = pthread_create(&fetchThreads[i], NULL, FetchFunc, &params[i]);
+    if (ret) {
+      UMAP_ERROR("Failed to launch fetchthread "<<i );
+    }
+  }
+
+  for(size_t i=0; i<num_fetch_threads; i++)
+    pthread_join(fetchThreads[i], NULL);
+}
+
+//
+// Called with s locked.  The page leaves the pinned set on its way out of
+// the buffer, and its descriptor is retired when it is released.
+//
+void Buffer::drop_pin( BufferShard* s, PageDescriptor* pd )
+{
+  s->m_pinned_pages.erase(pd);
+  pd->pinned = false;
+  --m_num_pinned;
+  ++m_num_retiring;
+}
+
+//
+// Make the pages of [paddr, paddr+size) resident and keep them that way
+// until they are unpinned.  Pinned pages are not counted against the size
+// of the buffer, but against a separate budget of pinned pages.  Pages that
+// are already present are moved out of the reach of the eviction policy,
+// and the rest are read in in parallel.
+//
+int Buffer::pin( char* paddr, uint64_t size )
+{
+  auto rd = m_rm.containing_region(paddr);
+
+  if ( rd == nullptr ) {
+    UMAP_LOG(Warning, "No region found for " << (void*)paddr);
+    errno = EINVAL;
+    return -1;
+  }
+
+  char* start = rd->start() + rd->page_index(paddr) * m_page_size;
+  char* end = ( size < (uint64_t)(rd->end() - paddr) ) ? paddr + size : rd->end();
+
+  pthread_mutex_lock(&m_resize_mutex);
+
+  //
+  // Pins are only added under m_resize_mutex, so no more pages than counted
+  // are needed below, but the page table and descriptors are only looked at
+  // under the shard lock
+  //
+  uint64_t needed = 0;
+  for ( char* addr = start; addr < end; addr += m_page_size ) {
+    BufferShard* s = shard_of(addr);
+    s->lock();
+    auto pd = rd->get_page_descriptor(addr);
+    if ( pd == nullptr || ! pd->pinned )
+      ++needed;
+    s->unlock();
+  }
+
+  if ( m_num_pinned + needed > m_max_pinned ) {
+    pthread_mutex_unlock(&m_resize_mutex);
+    UMAP_LOG(Warning, "Cannot pin " << needed << " more pages, "
+        << m_num_pinned << " of " << m_max_pinned << " pinned pages are in use");
+    errno = ENOMEM;
+    return -1;
+  }
+
+  std::vector<PageDescriptor*> spares;
+  std::vector<PageDescriptor*> fetch;
+  uint64_t moved = 0;
+
+  m_pool.get(needed, spares);
+
+  for ( char* addr = start; addr < end; addr += m_page_size ) {
+    BufferShard* s = shard_of(addr);
+    s->lock();
+
+    while ( 1 ) {
+      auto pd = rd->get_page_descriptor(addr);
+
+      if ( pd == nullptr ) {
+        if ( spares.empty() )
+          m_pool.get(1, spares);
+
+        pd = spares.back();
+        spares.pop_back();
+
+        pd->page = addr;
+        pd->region = rd;
+        pd->dirty = false;
+        pd->data_present = false;
+        pd->spurious_count = 0;
+        pd->set_state_filling();
+
+        rd->insert_page_descriptor(pd);
+        s->m_stats.pages_inserted++;
+        fetch.push_back(pd);
+      }
+      else if ( pd->pinned ) {
+        break;
+      }
+      else if ( s->m_policy->remove(pd) ) {
+        --m_num_busy;
+        ++moved;
+      }
+      else {
+        //
+        // The page is on its way out, bring it back in once it is gone
+        //
+        s->wait_for_change(pd);
+        continue;
+      }
+
+      pd->pinned = true;
+      s->m_pinned_pages.push_front(pd);
+      ++m_num_pinned;
+      break;
+    }
+
+    s->unlock();
+  }
+
+  m_pool.put(spares);
+
+  //
+  // Descriptors taken from the buffer for pages that were already present
+  // are replaced, so that the buffer keeps its size
+  //
+  if ( moved )
+    add_page_descriptors(moved);
+
+  pthread_mutex_unlock(&m_resize_mutex);
+
+  fetch_pages(fetch);
+
+  UMAP_LOG(Debug, needed << " pages pinned, " << fetch.size() << " read in");
+  return 0;
+}
+
+//
+// Give the pinned pages of [paddr, paddr+size) back to the eviction policy
+//
+int Buffer::unpin( char* paddr, uint64_t size )
+{
+  auto rd = m_rm.containing_region(paddr);
+
+  if ( rd == nullptr ) {
+    UMAP_LOG(Warning, "No region found for " << (void*)paddr);
+    errno = EINVAL;
+    return -1;
+  }
+
+  char* start = rd->start() + rd->page_index(paddr) * m_page_size;
+  char* end = ( size < (uint64_t)(rd->end() - paddr) ) ? paddr + size : rd->end();
+  uint64_t unpinned = 0;
+
+  pthread_mutex_lock(&m_resize_mutex);
+
+  for ( char* addr = start; addr < end; addr += m_page_size ) {
+    BufferShard* s = shard_of(addr);
+    s->lock();
+
+    auto pd = rd->get_page_descriptor(addr);
+    if ( pd != nullptr && pd->pinned ) {
+      s->m_pinned_pages.erase(pd);
+      pd->pinned = false;
+      --m_num_pinned;
+
+      s->m_policy->insert(pd);
+      ++m_num_busy;
+      ++unpinned;
+    }
+
+    s->unlock();
+  }
+
+  //
+  // The descriptors join the buffer along with their pages, so as many are
+  // taken back out to keep its size
+  //
+  if ( unpinned )
+    remove_page_descriptors(unpinned);
+
+  pthread_mutex_unlock(&m_resize_mutex);
+
+  if ( m_num_busy >= m_evict_high_water )
+    kick_evict_manager();
+
+  return 0;
+}
+
 void Buffer::fetch_and_pin(char* paddr, uint64_t size)
 {
-  lock();
   auto rd = m_rm.containing_region(paddr);
   
   if ( rd == nullptr )
@@ -260,9 +866,6 @@ void Buffer::fetch_and_pin(char* paddr, uint64_t size)
     UMAP_LOG(Info, "the prefetched rergion is larger than the region (end at "<<pend<<")");
   }
 
-  /* get aligned fetch size */
-  uint64_t offset_st = rd->store_offset( paddr );
-  uint64_t offset_end = rd->store_offset( pend );
   size = pend - paddr;
   
   /* Check free memory */
@@ -287,7 +890,7 @@ void Buffer::fetch_and_pin(char* paddr, uint64_t size)
   
 
   uint64_t psize = m_rm.get_umap_page_size();
-  size_t num_free_pages = m_free_pages.size();
+  size_t num_free_pages = m_num_free;
   uint64_t free_page_mem = psize * num_free_pages;
   uint64_t mem_avail = (mem_avail_kb*1024/psize) * psize;
 
@@ -302,12 +905,9 @@ void Buffer::fetch_and_pin(char* paddr, uint64_t size)
     uint64_t reduced_mem = ( free_page_mem + size) - mem_avail;
     if( reduced_mem < free_page_mem){
       size_t new_num_free_pages = (free_page_mem - reduced_mem)/psize;
-      m_free_pages.resize(new_num_free_pages);
-      
-      m_size = m_busy_pages.size() + m_free_pages.size();
-      m_evict_low_water = apply_int_percentage(m_rm.get_evict_low_water_threshold(), m_size);
-      m_evict_high_water = apply_int_percentage(m_rm.get_evict_high_water_threshold(), m_size);
-          
+      size_t num_dropped = num_free_pages - new_num_free_pages;
+
+      m_rm.set_max_pages_in_buffer(m_size - num_dropped);
       UMAP_LOG(Info, "Reduced Buffer Size to " << m_size );
 
     }else{
@@ -316,164 +916,577 @@ void Buffer::fetch_and_pin(char* paddr, uint64_t size)
     }
   }
 
-
-  /* get page alighed offset*/
-  Uffd* m_uffd = m_rm.get_uffd_h();
-  size_t num_pages = (offset_end - offset_st)/psize;
-  size_t num_fetch_threads = (num_pages>1024) ?8 : 1;
-  size_t stride = num_pages/num_fetch_threads*psize;
+  //
+  // This interface predates the pinned page budget, so the budget is
+  // raised to hold the request.
+  //
+  uint64_t num_pages = (size + psize - 1) / psize;
+  if ( m_num_pinned + num_pages > m_max_pinned )
+    m_max_pinned = m_num_pinned + num_pages;
 
   time_t start = time(NULL);
-  pthread_t fetchThreads[num_fetch_threads];
-  FetchFuncParams params[num_fetch_threads];
-  for(int i=0; i<num_fetch_threads; i++){
-    params[i].psize = psize;
-    params[i].rd = rd;
-    params[i].m_uffd = m_uffd;
-    params[i].offset_st = offset_st + stride*i;
-    params[i].offset_end = params[i].offset_st + stride;
-    if(i==(num_fetch_threads-1))
-      params[i].offset_end = offset_end;
-    UMAP_LOG(Info, "FetchThread "<<i<<" ["<<params[i].offset_st<<" , "<<params[i].offset_end<<"]");
-      
-    int ret = pthread_create(&fetchThreads[i], NULL, FetchFunc, &params[i]);
-    if (ret) {
-      UMAP_ERROR("Failed to launch fetchthread "<<i );
-    }
-  }
 
-  for(int i=0; i<num_fetch_threads; i++)
-    pthread_join(fetchThreads[i], NULL);
+  if ( pin(paddr, size) == -1 )
+    UMAP_ERROR("Failed to pin " << size << " bytes at " << (void*)paddr);
 
   time_t end = time(NULL);
   UMAP_LOG(Info,"Fetch_and_pin: "<< (end-start) << " seconds");
-
-  unlock();
 }
 
   
-void Buffer::process_page_event(char* paddr, bool iswrite, RegionDescriptor* rd)
+//
+// Handles a fault on paddr.  Unless asked to wait, a fault on a page that
+// is not in the buffer when no page descriptor is free is left alone, and
+// false returned, so that the handler can get on with faults that need none
+// while eviction makes room.
+//
+// The pages to fill for a fault on a page brought in are handed to the Fill
+// Workers, or back to the caller in fill if it is given.  fill->page_desc
+// is nullptr if there is nothing to fill.
+//
+bool Buffer::process_page_event(  char* paddr, bool iswrite, RegionDescriptor* rd
+                                , bool wait, WorkItem* fill, bool* throttled )
 {
   WorkItem work;
   work.type = Umap::WorkItem::WorkType::NONE;
+  work.page_desc = nullptr;
+  work.fill_start = paddr;
+  work.num_pages = 1;
+  bool missed = false;
 
-  lock();
-  auto pd = page_already_present(paddr);
+  if ( fill != nullptr )
+    *fill = work;
 
-  if ( pd != nullptr ) {  // Page is already present
-    if (iswrite && pd->dirty == false) {
-      work.page_desc = pd;
-      pd->dirty = true;
-      pd->set_state_updating();
-      UMAP_LOG(Debug, "PRE: " << pd << " From: " << this);
-    }
-    else {
-      static int hiwat = 0;
+  BufferShard* s = shard_of(paddr);
 
-      pd->spurious_count++;
-      if (pd->spurious_count > hiwat) {
-        hiwat = pd->spurious_count;
-        UMAP_LOG(Debug, "New Spurious cound high water mark: " << hiwat);
+  //
+  // Writes wait while too many pages are dirty, even those to pages that
+  // already are, for the writeback daemon to catch up.  Unless asked to
+  // wait, they are left alone like faults that find no page descriptor.
+  // A fault that is retried is only counted the first time, once throttled
+  // is set.
+  //
+  if ( iswrite && over_dirty_limit() ) {
+    if ( ! wait ) {
+      if ( throttled == nullptr || ! *throttled ) {
+        s->lock();
+        s->m_stats.throttled++;
+        s->unlock();
       }
 
-      UMAP_LOG(Debug, "SPU: " << pd << " From: " << this);
-      unlock();
-      return;
+      if ( throttled != nullptr )
+        *throttled = true;
+      return false;
     }
+
+    wait_for_dirty_pages_written();
   }
-  else {                  // This page has not been brought in yet
-    pd = get_page_descriptor(paddr, rd);
+
+  s->lock();
+
+  PageDescriptor* pd;
+  while ( 1 ) {
+    pd = page_already_present(s, rd, paddr);
+
+    if ( pd != nullptr ) {  // Page is already present
+      s->m_stats.hits++;
+      s->m_policy->hit(pd);
+
+      if (iswrite && pd->dirty == false) {
+        mark_dirty(pd);
+        pd->set_state_updating();
+        UMAP_LOG(Debug, "PRE: " << pd << " From: " << this);
+        s->m_stats.events_processed ++;
+        s->unlock();
+
+        //
+        // A write to a clean page only needs its write protection lifted,
+        // which takes less than handing it to the Fill Workers.  The thread
+        // is woken once the page is present again.
+        //
+        m_rm.get_uffd_h()->disable_write_protect(rd, paddr, false);
+        mark_page_as_present(pd);
+        m_rm.get_uffd_h()->wake_up(rd, paddr);
+        return true;
+      }
+      else {
+        static int hiwat = 0;
+
+        pd->spurious_count++;
+        if (pd->spurious_count > hiwat) {
+          hiwat = pd->spurious_count;
+          UMAP_LOG(Debug, "New Spurious cound high water mark: " << hiwat);
+        }
+
+        UMAP_LOG(Debug, "SPU: " << pd << " From: " << this);
+        s->unlock();
+
+        //
+        // Pages read ahead are filled without waking the threads that
+        // faulted on them
+        //
+        m_rm.get_uffd_h()->wake_up(rd, paddr);
+        return true;
+      }
+    }
+
+    if ( ! wait && ! page_descriptor_available(s) ) {
+      s->unlock();
+      bool available = take_available_page_descriptors(s) || m_num_unallocated;
+      s->lock();
+
+      if ( ! available ) {
+        s->m_stats.not_avail++;
+        s->m_stats.deferred++;
+        s->unlock();
+        return false;
+      }
+
+      continue;
+    }
+
+    //
+    // This page has not been brought in yet.  If we had to give up the shard
+    // lock to wait for a free descriptor, the page may have been brought in
+    // by someone else in the meantime, so look for it again.
+    //
+    pd = get_page_descriptor(s, paddr, rd);
+    if ( pd == nullptr )
+      continue;
+
     pd->data_present = false;
     work.page_desc = pd;
+    missed = true;
 
     rd->insert_page_descriptor(pd);
-    m_present_pages[pd->page] = pd;
 
     if (iswrite)
-      pd->dirty = true;
+      mark_dirty(pd);
 
     UMAP_LOG(Debug, "NEW: " << pd << " From: " << this);
+    break;
   }
 
-  m_rm.get_fill_workers_h()->send_work(work);
+  s->m_stats.events_processed ++;
+  s->unlock();
 
   //
-  // Kick the eviction daemon if the high water mark has been reached
+  // Pages around the fault and ahead of it are added before the fault is
+  // handed to the Fill Workers, since the faulting thread may unmap the
+  // region as soon as its page is filled
   //
-  if ( m_busy_pages.size() == m_evict_high_water ) {
-    WorkItem w;
+  ReadAhead::Window w;
+
+  if ( missed && rd->fault_around_pages() > 1 )
+    fault_around(rd, work);
+
+  if ( missed && rd->read_ahead().missed(rd->page_index(paddr), max_read_ahead(), w) )
+    read_ahead(rd, w);
+
+  if ( fill != nullptr )
+    *fill = work;
+  else
+    m_rm.get_fill_workers_h()->send_work(work);
 
-    w.type = Umap::WorkItem::WorkType::THRESHOLD;
-    w.page_desc = nullptr;
-    m_rm.get_evict_manager()->send_work(w);
+  return true;
+}
+
+uint64_t Buffer::max_read_ahead( void )
+{
+  return std::min(m_rm.get_read_ahead(), (uint64_t)m_size / 16);
+}
+
+//
+// Fill the pages of a read-ahead window of rd, other than its marker.  The
+// pages are handed to the Fill Workers behind any faults, and only free
+// page descriptors are used for them, so read-ahead never waits and never
+// starts eviction.
+//
+void Buffer::read_ahead( RegionDescriptor* rd, const ReadAhead::Window& w )
+{
+  for ( uint64_t n = 0; n < w.size; ++n ) {
+    uint64_t i = w.start + n * w.stride;
+
+    //
+    // Past either end of the region, as the index wraps below 0
+    //
+    if ( i >= rd->num_pages() )
+      break;
+
+    if ( i == w.marker )
+      continue;
+
+    bool full;
+    auto pd = add_page_ahead(rd, rd->start() + i * m_page_size, &BufferStats::read_ahead, full);
+
+    if ( full )
+      break;
+
+    if ( pd == nullptr )
+      continue;
+
+    WorkItem work;
+    work.type = Umap::WorkItem::WorkType::READ_AHEAD;
+    work.page_desc = pd;
+    work.fill_start = pd->page;
+    work.num_pages = 1;
+
+    m_rm.get_fill_workers_h()->send_low_priority_work(work);
+  }
+}
+
+//
+// Adds the missing pages next to the one faulted on in work to its fill,
+// within its fault-around cluster.  The run of pages stops short of any
+// page already in the buffer so that it can be copied in all at once, and
+// at the end of the userfaultfd stripe of the page.
+//
+void Buffer::fault_around( RegionDescriptor* rd, WorkItem& work )
+{
+  char* paddr = work.page_desc->page;
+  uint64_t page = rd->page_index(paddr);
+  uint64_t first = page & ~(rd->fault_around_pages() - 1);
+  uint64_t end = std::min(first + rd->fault_around_pages(), rd->num_pages());
+  uint64_t lo = page;
+  uint64_t hi = page + 1;
+  bool full = false;
+
+  auto add = [&]( uint64_t i ) {
+    char* page_addr = rd->start() + i * m_page_size;
+
+    return    rd->uffd_handler_of(page_addr) == rd->uffd_handler_of(paddr)
+           && add_page_ahead(rd, page_addr, &BufferStats::faulted_around, full) != nullptr;
+  };
+
+  while ( hi < end && add(hi) )
+    ++hi;
+
+  while ( ! full && lo > first && add(lo - 1) )
+    --lo;
+
+  work.fill_start = rd->start() + lo * m_page_size;
+  work.num_pages = hi - lo;
+}
+
+//
+// Adds a page to be filled ahead of any fault on it, and returns its
+// descriptor, or nullptr if the page is already in the buffer.  Only free
+// descriptors are used, so if there are none, or enough pages are in use
+// for eviction to start, nullptr is returned with full set.
+//
+PageDescriptor* Buffer::add_page_ahead(   RegionDescriptor* rd, char* page_addr
+                                        , uint64_t BufferStats::* stat, bool& full )
+{
+  BufferShard* s = shard_of(page_addr);
+  PageDescriptor* pd = nullptr;
+
+  full = false;
+  s->lock();
+
+  if ( rd->get_page_descriptor(page_addr) == nullptr ) {
+    if ( m_num_busy >= m_evict_high_water || ! page_descriptor_available(s) ) {
+      full = true;
+    }
+    else {
+      pd = get_page_descriptor(s, page_addr, rd);
+      pd->data_present = false;
+      rd->insert_page_descriptor(pd);
+      ++(s->m_stats.*stat);
+    }
   }
 
-  m_stats.events_processed ++;
-  unlock();
+  s->unlock();
+  return pd;
 }
 
 // Return nullptr if page not present, PageDescriptor * otherwise
-PageDescriptor* Buffer::page_already_present( char* page_addr )
+PageDescriptor* Buffer::page_already_present( BufferShard* s, RegionDescriptor* rd, char* page_addr )
 {
   while (1) {
-    auto pp = m_present_pages.find(page_addr);
-  
+    auto pd = rd->get_page_descriptor(page_addr);
+
     //
     // Most likely case
     //
-    if ( pp == m_present_pages.end() )
+    if ( pd == nullptr )
       return nullptr;
 
     //
     // Next most likely is that it is just present in the buffer
     //
-    if ( pp->second->state == PageDescriptor::State::PRESENT )
-      return pp->second;
+    if ( pd->state == PageDescriptor::State::PRESENT )
+      return pd;
 
     // There is a chance that the state of this page is not/no-longer
     // PRESENT.  If this is the case, we need to wait for it to finish
     // with whatever is happening to it and then check again
     //
-    UMAP_LOG(Debug, "Waiting for state: (ANY)" << ", " << pp->second);
+    UMAP_LOG(Debug, "Waiting for state: (ANY)" << ", " << pd);
 
-    ++m_stats.waits;
-    ++m_waits_for_state_change;
-    pthread_cond_wait(&m_state_change_cond, &m_mutex);
-    --m_waits_for_state_change;
+    s->wait_for_change(pd);
   }
 }
 
-PageDescriptor* Buffer::get_page_descriptor(char* vaddr, RegionDescriptor* rd)
+//
+// Returns nullptr if the shard lock had to be given up while waiting for a
+// page descriptor to become available.
+//
+PageDescriptor* Buffer::get_page_descriptor(BufferShard* s, char* vaddr, RegionDescriptor* rd)
 {
-  while ( m_free_pages.size() == 0 )  {
-    ++m_waits_for_avail_pd;
-    m_stats.not_avail++;
-
-    ++m_stats.waits;
-    ++m_waits_for_state_change;
-    pthread_cond_wait(&m_avail_pd_cond, &m_mutex);
-
-    --m_waits_for_avail_pd;
+  if ( ! page_descriptor_available(s) ) {
+    s->m_stats.not_avail++;
+    ++s->m_stats.waits;
+
+    s->unlock();
+    wait_for_available_page_descriptor(s);
+    s->lock();
+    return nullptr;
   }
 
   PageDescriptor* rval;
 
-  rval = m_free_pages.back();
-  m_free_pages.pop_back();
+  rval = s->m_free_pages.back();
+  s->m_free_pages.pop_back();
+  --m_num_free;
 
   rval->page = vaddr;
   rval->region = rd;
   rval->dirty = false;
-  rval->deferred = false;
+  rval->pinned = false;
   rval->set_state_filling();
   rval->spurious_count = 0;
 
-  m_stats.pages_inserted++;
-  m_busy_pages.push_front(rval);
+  s->m_stats.pages_inserted++;
+  s->m_policy->insert(rval);
+
+  //
+  // Kick the eviction daemon if the high water mark has been reached.  The
+  // count may pass the mark by more than one at a time, from other shards,
+  // unpins or a resize, so any page over it will do.
+  //
+  if ( ++m_num_busy >= m_evict_high_water )
+    kick_evict_manager();
 
   return rval;
 }
 
+//
+// Change the number of pages the buffer may hold.  Growing takes effect
+// immediately.  When shrinking, free descriptors are given up right away
+// and the Evict Manager is started if the new high water mark has been
+// passed.  The rest of the descriptors are retired as their pages are
+// evicted.
+//
+void Buffer::resize( uint64_t num_pages )
+{
+  pthread_mutex_lock(&m_resize_mutex);
+
+  uint64_t old_size = m_size;
+
+  if ( num_pages > old_size )
+    add_page_descriptors(num_pages - old_size);
+  else if ( num_pages < old_size )
+    remove_page_descriptors(old_size - num_pages);
+
+  m_size = num_pages;
+  m_evict_low_water = apply_int_percentage(m_rm.get_evict_low_water_threshold(), m_size);
+  m_evict_high_water = apply_int_percentage(m_rm.get_evict_high_water_threshold(), m_size);
+  set_dirty_thresholds();
+
+  for ( uint64_t i = 0; i < m_num_shards; ++i ) {
+    m_shards[i].lock();
+    m_shards[i].m_policy->set_capacity(m_size / m_num_shards);
+    m_shards[i].unlock();
+  }
+
+  pthread_mutex_unlock(&m_resize_mutex);
+
+  UMAP_LOG(Info, "Buffer resized from " << old_size << " to " << num_pages << " pages");
+
+  if ( m_num_busy >= m_evict_high_water )
+    kick_evict_manager();
+}
+
+void Buffer::add_page_descriptors( uint64_t num_pages )
+{
+  //
+  // Descriptors that have not been retired yet are simply kept, the rest
+  // are taken from the pool by the shards as they need them
+  //
+  uint64_t retiring = m_num_retiring;
+  uint64_t kept;
+  do {
+    kept = std::min(retiring, num_pages);
+  } while ( ! m_num_retiring.compare_exchange_weak(retiring, retiring - kept) );
+
+  m_num_unallocated += num_pages - kept;
+  page_descriptors_made_available();
+}
+
+//
+// Give up descriptors that have not been taken yet first, then free ones,
+// and retire the rest as their pages are evicted
+//
+void Buffer::remove_page_descriptors( uint64_t num_pages )
+{
+  uint64_t unallocated = m_num_unallocated;
+  uint64_t n;
+  do {
+    n = std::min(unallocated, num_pages);
+  } while ( ! m_num_unallocated.compare_exchange_weak(unallocated, unallocated - n) );
+  num_pages -= n;
+
+  for ( uint64_t i = 0; i < m_num_shards && num_pages; ++i ) {
+    BufferShard* s = &m_shards[i];
+    std::vector<PageDescriptor*> pages;
+
+    s->lock();
+    for ( ; num_pages && s->m_free_pages.size(); --num_pages ) {
+      pages.push_back(s->m_free_pages.back());
+      s->m_free_pages.pop_back();
+      --m_num_free;
+    }
+    m_pool.put(pages);
+    s->unlock();
+  }
+
+  m_num_retiring += num_pages;
+}
+
+//
+// The Evict Manager is only sent one request per crossing of the high water
+// mark, as it evicts down to the low water mark each time
+//
+void Buffer::kick_evict_manager( void )
+{
+  if ( m_evict_kicked.exchange(true) )
+    return;
+
+  WorkItem w;
+
+  w.type = Umap::WorkItem::WorkType::THRESHOLD;
+  w.page_desc = nullptr;
+  m_rm.get_evict_manager()->send_work(w);
+}
+
+void Buffer::kick_writeback( void )
+{
+  WritebackDaemon* wb = m_rm.get_writeback_daemon();
+
+  if ( wb != nullptr )
+    wb->kick();
+}
+
+//
+// The thresholds follow the size of the buffer, and are at least a page so
+// that a small buffer does not throttle every write
+//
+void Buffer::set_dirty_thresholds( void )
+{
+  int background = m_rm.get_dirty_background_ratio();
+  int limit = m_rm.get_dirty_ratio();
+
+  m_dirty_background = background ? std::max(apply_int_percentage(background, m_size), (uint64_t)1) : 0;
+  m_dirty_limit = limit ? std::max(apply_int_percentage(limit, m_size), m_dirty_background + 1) : 0;
+}
+
+//
+// Waits as wait_for_available_page_descriptor() does, but for there to be
+// fewer dirty pages than the hard limit
+//
+void Buffer::wait_for_dirty_pages_written( void )
+{
+  while ( 1 ) {
+    uint64_t generation = m_avail_pd_generation;
+
+    if ( ! over_dirty_limit() )
+      return;
+
+    pthread_mutex_lock(&m_avail_pd_mutex);
+    ++m_waits_for_avail_pd;
+
+    while ( m_avail_pd_generation == generation )
+      pthread_cond_wait(&m_avail_pd_cond, &m_avail_pd_mutex);
+
+    --m_waits_for_avail_pd;
+    pthread_mutex_unlock(&m_avail_pd_mutex);
+  }
+}
+
+//
+// Called by the writeback daemon.  Writes dirty pages back, in address
+// order from where the last call left off, until no more of them are dirty
+// than the background threshold.  Pages are written a batch at a time, as
+// flushes are, in runs of neighbouring pages.  Pages that are not present,
+// or that changed since they were looked at, are passed over.
+//
+void Buffer::write_back_dirty_pages( void )
+{
+  const uint64_t batch = 256;
+  std::vector<PageDescriptor*> busy_pages;
+  std::vector<std::pair<char*, RegionDescriptor*>> dirty;
+  std::vector<PageDescriptor*> flushes;
+
+  if ( m_dirty_background == 0 || m_num_dirty <= m_dirty_background )
+    return;
+
+  //
+  // Descriptors may be given back to the pool, and freed with it, once
+  // the shard lock is let go, so pages are remembered by address and region
+  // and looked up again before they are written back.  Regions stay until
+  // the pass is done, see evict_region().
+  //
+  pthread_mutex_lock(&m_writeback_mutex);
+
+  for ( uint64_t i = 0; i < m_num_shards; ++i ) {
+    BufferShard* s = &m_shards[i];
+
+    busy_pages.clear();
+    s->lock();
+    s->m_policy->pages(busy_pages);
+    s->m_pinned_pages.pages(busy_pages);
+
+    for ( auto pd : busy_pages ) {
+      if ( pd->dirty && pd->state == PageDescriptor::State::PRESENT )
+        dirty.push_back(std::make_pair(pd->page, pd->region));
+    }
+    s->unlock();
+  }
+
+  std::sort(dirty.begin(), dirty.end());
+
+  auto first = std::upper_bound(  dirty.begin(), dirty.end()
+                                , std::make_pair(m_writeback_cursor, (RegionDescriptor*)UINTPTR_MAX));
+  std::size_t next = first - dirty.begin();
+
+  for ( std::size_t n = 0; n < dirty.size() && m_num_dirty > m_dirty_background; ) {
+    uint64_t want = std::min(batch, m_num_dirty - m_dirty_background);
+
+    flushes.clear();
+    for ( ; n < dirty.size() && flushes.size() < want; ++n, ++next ) {
+      auto& d = dirty[next % dirty.size()];
+      BufferShard* s = shard_of(d.first);
+
+      s->lock();
+      auto pd = d.second->get_page_descriptor(d.first);
+      if ( pd != nullptr && pd->dirty && pd->state == PageDescriptor::State::PRESENT ) {
+        pd->set_state_updating();
+        flushes.push_back(pd);
+        m_writeback_cursor = d.first;
+      }
+      s->unlock();
+    }
+
+    if ( flushes.empty() )
+      break;
+
+    m_rm.get_evict_manager()->schedule_flushes(flushes);
+    m_rm.get_evict_manager()->WaitAll();
+  }
+
+  pthread_mutex_unlock(&m_writeback_mutex);
+}
+
 uint64_t Buffer::apply_int_percentage( int percentage, uint64_t item )
 {
   uint64_t rval;
@@ -491,7 +1504,27 @@ uint64_t Buffer::apply_int_percentage( int percentage, uint64_t item )
   return rval;
 }
 
-void Buffer::lock()
+BufferShard::BufferShard( void )
+  : m_policy(nullptr), m_pinned_pages(3)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+
+  for ( auto& q : m_wait_queues ) {
+    q.waiters = 0;
+    pthread_cond_init(&q.cond, NULL);
+  }
+}
+
+BufferShard::~BufferShard( void )
+{
+  delete m_policy;
+  for ( auto& q : m_wait_queues )
+    pthread_cond_destroy(&q.cond);
+
+  pthread_mutex_destroy(&m_mutex);
+}
+
+void BufferShard::lock()
 {
   int err;
   if ( (err = pthread_mutex_trylock(&m_mutex)) != 0 ) {
@@ -505,23 +1538,60 @@ void Buffer::lock()
   m_stats.lock++;
 }
 
-void Buffer::unlock()
+bool BufferShard::trylock()
+{
+  int err;
+  if ( (err = pthread_mutex_trylock(&m_mutex)) != 0 ) {
+    if (err != EBUSY)
+      UMAP_ERROR("pthread_mutex_trylock failed: " << strerror(err));
+    return false;
+  }
+  m_stats.lock++;
+  return true;
+}
+
+void BufferShard::unlock()
 {
   pthread_mutex_unlock(&m_mutex);
 }
 
-void Buffer::wait_for_page_state( PageDescriptor* pd, PageDescriptor::State st)
+void BufferShard::wait_for_change( PageDescriptor* pd )
+{
+  WaitQueue* q = wait_queue_of(pd);
+
+  ++m_stats.waits;
+  ++q->waiters;
+  pthread_cond_wait(&q->cond, &m_mutex);
+  --q->waiters;
+}
+
+void BufferShard::wake_waiters( PageDescriptor* pd )
+{
+  WaitQueue* q = wait_queue_of(pd);
+
+  if ( q->waiters )
+    pthread_cond_broadcast(&q->cond);
+}
+
+void Buffer::wait_for_page_state( BufferShard* s, PageDescriptor* pd, PageDescriptor::State st)
 {
   UMAP_LOG(Debug, "Waiting for state: " << st << ", " << pd);
 
-  while ( pd->state != st ) {
-    ++m_stats.waits;
-    ++m_waits_for_state_change;
+  while ( pd->state != st )
+    s->wait_for_change(pd);
+}
 
-    pthread_cond_wait(&m_state_change_cond, &m_mutex);
+BufferStats Buffer::get_stats( void ) const
+{
+  BufferStats stats;
 
-    --m_waits_for_state_change;
+  for ( uint64_t i = 0; i < m_num_shards; ++i ) {
+    stats += m_shards[i].m_stats;
+    stats.second_chances += m_shards[i].m_policy->second_chances();
+    stats.ghost_hits += m_shards[i].m_policy->ghost_hits();
   }
+
+  return stats;
 }
 
 void Buffer::monitor(void)
@@ -533,9 +1603,12 @@ void Buffer::monitor(void)
   while( is_monitor_on ){
 
     UMAP_LOG(Info, "m_size = " << m_size
-	     << ", num_busy_pages = " << m_busy_pages.size()
-	     << ", num_free_pages = " << m_free_pages.size()
-	     << ", events_processed = " << m_stats.events_processed );
+	     << ", num_busy_pages = " << m_num_busy
+	     << ", num_pinned_pages = " << m_num_pinned
+	     << ", num_free_pages = " << m_num_free
+	     << ", num_descriptors = " << m_pool.num_in_use()
+	     << " in " << m_pool.num_slabs() << " slabs"
+	     << ", events_processed = " << get_stats().events_processed );
 
     sleep(monitor_interval);
 
@@ -546,23 +1619,51 @@ void Buffer::monitor(void)
 Buffer::Buffer( void )
   :     m_rm(RegionManager::getInstance())
       , m_size(m_rm.get_max_pages_in_buffer())
+      , m_page_size(m_rm.get_umap_page_size())
+      , m_num_unallocated(m_size.load())
+      , m_num_retiring(0)
+      , m_num_pinned(0)
+      , m_max_pinned(m_rm.get_max_pinned_pages())
+      , m_num_shards(m_rm.get_num_buffer_shards())
+      , m_evict_cursor(0)
+      , m_idle_tracker(nullptr)
+      , m_num_busy(0)
+      , m_num_free(0)
+      , m_evict_kicked(false)
+      , m_num_dirty(0)
+      , m_dirty_background(0)
+      , m_dirty_limit(0)
+      , m_writeback_cursor(nullptr)
       , m_waits_for_avail_pd(0)
-      , m_waits_for_state_change(0)
+      , m_avail_pd_generation(0)
 {
-  m_array = (PageDescriptor *)calloc(m_size, sizeof(PageDescriptor));
-  if ( m_array == nullptr )
-    UMAP_ERROR("Failed to allocate " << m_size*sizeof(PageDescriptor)
-        << " bytes for buffer page descriptors");
+  pthread_mutex_init(&m_resize_mutex, NULL);
+  pthread_mutex_init(&m_writeback_mutex, NULL);
 
-  for ( int i = 0; i < m_size; ++i )
-    m_free_pages.push_back(&m_array[i]);
+  m_shards = new BufferShard[m_num_shards];
 
-  pthread_mutex_init(&m_mutex, NULL);
+  //
+  // The CLOCK policy uses the hardware accessed bit when the kernel lets us
+  // see it, otherwise only faults on present pages count as references.
+  //
+  if ( m_rm.get_evict_policy() == "CLOCK" ) {
+    m_idle_tracker = new IdlePageTracker(m_page_size);
+
+    if ( ! m_idle_tracker->available() ) {
+      delete m_idle_tracker;
+      m_idle_tracker = nullptr;
+    }
+  }
+
+  for ( uint64_t i = 0; i < m_num_shards; ++i )
+    m_shards[i].m_policy = EvictPolicy::create(m_rm.get_evict_policy(), m_size / m_num_shards);
+
+  pthread_mutex_init(&m_avail_pd_mutex, NULL);
   pthread_cond_init(&m_avail_pd_cond, NULL);
-  pthread_cond_init(&m_state_change_cond, NULL);
 
   m_evict_low_water = apply_int_percentage(m_rm.get_evict_low_water_threshold(), m_size);
   m_evict_high_water = apply_int_percentage(m_rm.get_evict_high_water_threshold(), m_size);
+  set_dirty_thresholds();
 
   /* monitor page stats periodically */
   if( m_rm.get_monitor_freq()>0 ){
@@ -579,29 +1680,57 @@ Buffer::Buffer( void )
 
 Buffer::~Buffer( void ) {
 #ifdef UMAP_DISPLAY_STATS
-  std::cout << m_stats << std::endl;
+  std::cout << get_stats() << std::endl;
 #endif
 
   if( is_monitor_on ){
     is_monitor_on = false;
     pthread_join( monitorThread , NULL );
   }
-  
-  assert("Pages are still present" && m_present_pages.size() == 0);
+
+  assert("Pages are still present" && m_num_busy == 0);
+  assert("Pinned pages are still present" && m_num_pinned == 0);
+  assert("Dirty pages are still counted" && m_num_dirty == 0);
+
+  for ( uint64_t i = 0; i < m_num_shards; ++i )
+    m_pool.put(m_shards[i].m_free_pages);
+
+  delete [] m_shards;
+  delete m_idle_tracker;
   pthread_cond_destroy(&m_avail_pd_cond);
-  pthread_cond_destroy(&m_state_change_cond);
-  pthread_mutex_destroy(&m_mutex);
-  free(m_array);
+  pthread_mutex_destroy(&m_avail_pd_mutex);
+  pthread_mutex_destroy(&m_resize_mutex);
+  pthread_mutex_destroy(&m_writeback_mutex);
+}
+
+BufferStats& BufferStats::operator+=(const BufferStats& rhs)
+{
+  lock_collision += rhs.lock_collision;
+  lock += rhs.lock;
+  pages_inserted += rhs.pages_inserted;
+  pages_deleted += rhs.pages_deleted;
+  not_avail += rhs.not_avail;
+  waits += rhs.waits;
+  events_processed += rhs.events_processed;
+  hits += rhs.hits;
+  second_chances += rhs.second_chances;
+  ghost_hits += rhs.ghost_hits;
+  read_ahead += rhs.read_ahead;
+  faulted_around += rhs.faulted_around;
+  deferred += rhs.deferred;
+  throttled += rhs.throttled;
+  return *this;
 }
 
 std::ostream& operator<<(std::ostream& os, const Umap::Buffer* b)
 {
   if ( b != nullptr ) {
     os << "{ m_size: " << b->m_size
+      << ", m_num_shards: " << b->m_num_shards
       << ", m_waits_for_avail_pd: " << b->m_waits_for_avail_pd
-      << ", m_present_pages.size(): " << std::setw(2) << b->m_present_pages.size()
-      << ", m_free_pages.size(): " << std::setw(2) << b->m_free_pages.size()
-      << ", m_busy_pages.size(): " << std::setw(2) << b->m_busy_pages.size()
+      << ", m_num_free: " << std::setw(2) << b->m_num_free
+      << ", m_num_busy: " << std::setw(2) << b->m_num_busy
+      << ", m_num_pinned: " << b->m_num_pinned
       << " }"
       ;
   }
@@ -616,7 +1745,14 @@ std::ostream& operator<<(std::ostream& os, const Umap::BufferStats& stats)
   os << "Buffer Statisics:\n"
     << "   Pages Inserted: " << std::setw(12) << stats.pages_inserted<< "\n"
     << "    Pages Deleted: " << std::setw(12) << stats.pages_deleted<< "\n"
+    << "     Present hits: " << std::setw(12) << stats.hits<< "\n"
+    << "   Second chances: " << std::setw(12) << stats.second_chances<< "\n"
+    << "       Ghost hits: " << std::setw(12) << stats.ghost_hits<< "\n"
+    << "       Read ahead: " << std::setw(12) << stats.read_ahead<< "\n"
+    << "   Faulted around: " << std::setw(12) << stats.faulted_around<< "\n"
     << " Unavailable wait: " << std::setw(12) << stats.not_avail<< "\n"
+    << "  Faults deferred: " << std::setw(12) << stats.deferred<< "\n"
+    << " Writes throttled: " << std::setw(12) << stats.throttled<< "\n"
     << "            Locks: " << std::setw(12) << stats.lock << "\n"
     << "  Lock collisions: " << std::setw(12) << stats.lock_collision << "\n"
     << "            waits: " << std::setw(12) << stats.waits;
@@ -7,23 +7,31 @@
 #ifndef _UMAP_Buffer_HPP
 #define _UMAP_Buffer_HPP
 
+#include <atomic>
 #include <pthread.h>
-#include <unordered_map>
 #include <vector>
-#include <deque>
 
+#include "umap/EvictPolicy.hpp"
+#include "umap/IdlePageTracker.hpp"
 #include "umap/RegionDescriptor.hpp"
 #include "umap/PageDescriptor.hpp"
+#include "umap/PageDescriptorPool.hpp"
+#include "umap/PageList.hpp"
 
 namespace Umap {
   class RegionManager;
+  struct WorkItem;
 
   struct BufferStats {
     BufferStats() :   lock_collision(0), lock(0), pages_inserted(0)
                     , pages_deleted(0), not_avail(0), waits(0)
-                    , events_processed(0)
+                    , events_processed(0), hits(0), second_chances(0)
+                    , ghost_hits(0), read_ahead(0), faulted_around(0)
+                    , deferred(0), throttled(0)
     {};
 
+    BufferStats& operator+=(const BufferStats& rhs);
+
     uint64_t lock_collision;
     uint64_t lock;
     uint64_t pages_inserted;
@@ -31,6 +39,59 @@ namespace Umap {
     uint64_t not_avail;
     uint64_t waits;
     uint64_t events_processed;
+    uint64_t hits;              // Faults on pages already in the buffer
+    uint64_t second_chances;    // Referenced pages passed over by eviction
+    uint64_t ghost_hits;        // Pages faulted in again soon after eviction
+    uint64_t read_ahead;        // Pages filled ahead of sequential faults
+    uint64_t faulted_around;    // Pages filled along with a fault next to them
+    uint64_t deferred;          // Faults put off until a descriptor was free
+    uint64_t throttled;         // Writes put off while too many pages were dirty
+  };
+
+  //
+  // The Buffer is split into a number of shards, each of which owns the
+  // pages whose addresses hash to it.  A shard has its own lock, free list,
+  // eviction policy, and wait queues so that faults on pages in different
+  // shards do not contend with one another.  The shard lock also protects
+  // the RegionDescriptor page table slots of the pages it owns.
+  //
+  struct BufferShard {
+    BufferShard( void );
+    ~BufferShard( void );
+
+    void lock( void );
+    bool trylock( void );
+    void unlock( void );
+
+    // Called with the shard locked
+    void wait_for_change( PageDescriptor* pd );
+    void wake_waiters( PageDescriptor* pd );
+
+    pthread_mutex_t m_mutex;
+
+    //
+    // Threads waiting for a page descriptor to change state sleep on a
+    // wait queue chosen by hashing the descriptor, so that a state change
+    // only wakes the threads waiting on that page and the few whose pages
+    // share its queue.
+    //
+    static const int NUM_WAIT_QUEUES = 64;
+
+    struct WaitQueue {
+      int waiters;
+      pthread_cond_t cond;
+    };
+    WaitQueue m_wait_queues[NUM_WAIT_QUEUES];
+
+    inline WaitQueue* wait_queue_of( PageDescriptor* pd ) {
+      return &m_wait_queues[((uint64_t)pd / sizeof(PageDescriptor)) % NUM_WAIT_QUEUES];
+    }
+
+    std::vector<PageDescriptor*> m_free_pages;
+    EvictPolicy* m_policy;      // Holds the busy pages of the shard
+    PageList m_pinned_pages;
+
+    BufferStats m_stats;
   };
 
   class Buffer {
@@ -38,43 +99,94 @@ namespace Umap {
     friend std::ostream& operator<<(std::ostream& os, const Umap::BufferStats& stats);
     public:
       void mark_page_as_present(PageDescriptor* pd);
+      void mark_page_as_flushed( PageDescriptor* pd );
       void mark_page_as_free( PageDescriptor* pd );
 
       bool low_threshold_reached( void );
+      void evict_pass_done( void );
 
       void fetch_and_pin(char* paddr, uint64_t size);
+      int pin( char* paddr, uint64_t size );
+      int unpin( char* paddr, uint64_t size );
+      void resize( uint64_t num_pages );
+      uint64_t get_size( void ) { return m_size; }
 
       PageDescriptor* evict_oldest_page( void );
       std::vector<PageDescriptor*> evict_oldest_pages( void );
-      void process_page_event(char* paddr, bool iswrite, RegionDescriptor* rd);
+      bool process_page_event(  char* paddr, bool iswrite, RegionDescriptor* rd
+                              , bool wait = true, WorkItem* fill = nullptr
+                              , bool* throttled = nullptr );
+      uint64_t page_descriptor_generation( void ) { return m_avail_pd_generation; }
+      void read_ahead( RegionDescriptor* rd, const ReadAhead::Window& w );
+      uint64_t max_read_ahead( void );
       void evict_region(RegionDescriptor* rd);
       void flush_dirty_pages();
-    
+      void write_back_dirty_pages( void );
+      void harvest_written_pages( RegionDescriptor* rd, bool protect );
+
       explicit Buffer( void );
       ~Buffer( void );
 
     private:
       RegionManager& m_rm;
-      uint64_t m_size;          // Maximum pages this buffer may have
-      PageDescriptor* m_array;
+      std::atomic<uint64_t> m_size;   // Maximum pages this buffer may have
+      uint64_t m_page_size;
 
-      std::unordered_map<char*, PageDescriptor*> m_present_pages;
+      //
+      // Page descriptors are taken from the pool a batch at a time by the
+      // shard that needs them, until the buffer has as many as its size
+      // allows.  Descriptors given up when the buffer shrinks go back to
+      // the pool.  Those still in use when the buffer shrinks are retired
+      // as they are released.
+      //
+      pthread_mutex_t m_resize_mutex;
+      PageDescriptorPool m_pool;
+      std::atomic<uint64_t> m_num_unallocated;  // Descriptors yet to be taken
+      std::atomic<uint64_t> m_num_retiring;
 
-      std::vector<PageDescriptor*> m_free_pages;
-      std::deque<PageDescriptor*> m_busy_pages;
+      //
+      // Pinned pages are kept out of the eviction policies and off the busy
+      // count.  Their descriptors come straight from the pool rather than
+      // from the buffer.
+      //
+      std::atomic<uint64_t> m_num_pinned;
+      std::atomic<uint64_t> m_max_pinned;
 
-      uint64_t m_evict_low_water;   // % to evict too
-      uint64_t m_evict_high_water;  // % to start evicting
+      uint64_t m_num_shards;
+      BufferShard* m_shards;
+      std::atomic<uint64_t> m_evict_cursor;   // Next shard to evict from
 
-      pthread_mutex_t m_mutex;
+      IdlePageTracker* m_idle_tracker;        // nullptr if not available
 
-      int m_waits_for_avail_pd;
-      pthread_cond_t m_avail_pd_cond;
+      std::atomic<uint64_t> m_num_busy;       // Pages on the busy lists
+      std::atomic<uint64_t> m_num_free;       // Pages on the free lists
 
-      int m_waits_for_state_change;
-      pthread_cond_t m_state_change_cond;
+      std::atomic<uint64_t> m_evict_low_water;   // % to evict too
+      std::atomic<uint64_t> m_evict_high_water;  // % to start evicting
+      std::atomic<bool> m_evict_kicked;          // Evict Manager started
+
+      //
+      // Dirty pages are counted as their descriptors are marked dirty and
+      // clean, under the shard lock.  The thresholds are in pages, 0 if
+      // not set.  The writeback cursor is where the last background
+      // writeback left off.
+      //
+      std::atomic<uint64_t> m_num_dirty;
+      std::atomic<uint64_t> m_dirty_background;
+      std::atomic<uint64_t> m_dirty_limit;
+      char* m_writeback_cursor;
+      pthread_mutex_t m_writeback_mutex;      // Keeps regions from going during writeback
+
+      //
+      // Page descriptors may be released into any shard, so waiting for one
+      // to become available is done on a condition shared by all shards.
+      // The generation changes whenever descriptors are made available.
+      //
+      pthread_mutex_t m_avail_pd_mutex;
+      std::atomic<int> m_waits_for_avail_pd;
+      std::atomic<uint64_t> m_avail_pd_generation;
+      pthread_cond_t m_avail_pd_cond;
 
-      BufferStats m_stats;
       bool is_monitor_on;
       pthread_t monitorThread;
       void monitor(void);
@@ -83,15 +195,59 @@ namespace Umap {
         return NULL;
       }
 
-      void release_page_descriptor( PageDescriptor* pd );
+      inline BufferShard* shard_of( char* page_addr ) {
+        return &m_shards[((uint64_t)page_addr / m_page_size) % m_num_shards];
+      }
+
+      // Called with the shard of pd locked
+      inline void mark_dirty( PageDescriptor* pd ) {
+        if ( pd->dirty )
+          return;
+
+        pd->dirty = true;
+        if ( ++m_num_dirty > m_dirty_background && m_dirty_background )
+          kick_writeback();
+      }
+
+      // Called with the shard of pd locked
+      inline void mark_clean( PageDescriptor* pd ) {
+        if ( ! pd->dirty )
+          return;
+
+        pd->dirty = false;
+        if ( --m_num_dirty < m_dirty_limit )
+          page_descriptors_made_available();
+      }
+
+      bool over_dirty_limit( void ) {
+        return m_dirty_limit && m_num_dirty >= m_dirty_limit;
+      }
+
+      void release_page_descriptor( BufferShard* s, PageDescriptor* pd );
+      bool allocate_page_descriptors( BufferShard* s );
+      bool steal_page_descriptors( BufferShard* s );
+      bool take_available_page_descriptors( BufferShard* s );
+      void wait_for_available_page_descriptor( BufferShard* s );
+      void page_descriptors_made_available( void );
+      bool page_descriptor_available( BufferShard* s );
+      void fault_around( RegionDescriptor* rd, WorkItem& work );
+      PageDescriptor* add_page_ahead(   RegionDescriptor* rd, char* page_addr
+                                      , uint64_t BufferStats::* stat, bool& full );
 
-      PageDescriptor* page_already_present( char* page_addr );
-      PageDescriptor* get_page_descriptor( char* page_addr, RegionDescriptor* rd );
+      PageDescriptor* page_already_present( BufferShard* s, RegionDescriptor* rd, char* page_addr );
+      PageDescriptor* get_page_descriptor( BufferShard* s, char* page_addr, RegionDescriptor* rd );
       uint64_t apply_int_percentage( int percentage, uint64_t item );
+      void add_page_descriptors( uint64_t num_pages );
+      void remove_page_descriptors( uint64_t num_pages );
+      void drop_pin( BufferShard* s, PageDescriptor* pd );
+      void fetch_pages( std::vector<PageDescriptor*>& pages );
+      void kick_evict_manager( void );
+      void kick_writeback( void );
+      void set_dirty_thresholds( void );
+      void wait_for_dirty_pages_written( void );
 
-      void lock();
-      void unlock();
-      void wait_for_page_state( PageDescriptor* pd, PageDescriptor::State st);
+      BufferStats get_stats( void ) const;
+      void wait_for_page_state( BufferShard* s, PageDescriptor* pd, PageDescriptor::State st);
   };
 
   std::ostream& operator<<(std::ostream& os, const Umap::BufferStats& stats);
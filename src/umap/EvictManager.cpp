@@ -5,6 +5,8 @@
 // SPDX-License-Identifier: LGPL-2.1-only
 //////////////////////////////////////////////////////////////////////////////
 
+#include <algorithm>            // std::sort()
+
 #include "umap/Buffer.hpp"
 #include "umap/EvictManager.hpp"
 #include "umap/EvictWorkers.hpp"
@@ -32,20 +34,19 @@ void EvictManager::EvictMgr( void ) {
       if ( work.page_desc == nullptr )
         break;
 
+      work.fill_start = work.page_desc->page;
+      work.num_pages = 1;
+
       UMAP_LOG(Debug, m_buffer << ", " << work.page_desc);
 
       m_evict_workers->send_work(work);
 #else
       std::vector<PageDescriptor*> evicted_pages = m_buffer->evict_oldest_pages();
-      for(auto pd : evicted_pages){
-        WorkItem work;
-        work.type = Umap::WorkItem::WorkType::EVICT;
-        work.page_desc = pd;
-        assert( work.page_desc != nullptr );
-        m_evict_workers->send_work(work);
-      }
+      send_runs(evicted_pages, Umap::WorkItem::WorkType::EVICT);
 #endif
     }
+
+    m_buffer->evict_pass_done();
   }
 }
 void EvictManager::WaitAll( void )
@@ -58,35 +59,81 @@ void EvictManager::WaitAll( void )
 void EvictManager::EvictAll( void )
 {
   UMAP_LOG(Debug, "Entered");
+  std::vector<PageDescriptor*> dirty_pages;
 
   for (auto pd = m_buffer->evict_oldest_page(); pd != nullptr; pd = m_buffer->evict_oldest_page()) {
     UMAP_LOG(Debug, "evicting: " << pd);
     if (pd->dirty) {
-      WorkItem work = { .page_desc = pd, .type = Umap::WorkItem::WorkType::FAST_EVICT };
-      m_evict_workers->send_work(work);
+      dirty_pages.push_back(pd);
     }
     else {
       m_buffer->mark_page_as_free(pd);
     }
   }
 
+  send_runs(dirty_pages, Umap::WorkItem::WorkType::FAST_EVICT);
+
   m_evict_workers->wait_for_idle();
 
   UMAP_LOG(Debug, "Done");
 }
 
-void EvictManager::schedule_eviction(PageDescriptor* pd)
+//
+// A fast eviction writes the page back only if it is known to be dirty, and
+// leaves it mapped
+//
+void EvictManager::schedule_eviction(PageDescriptor* pd, bool fast)
 {
-  WorkItem work = { .page_desc = pd, .type = Umap::WorkItem::WorkType::EVICT };
+  WorkItem work = {};
+
+  work.page_desc = pd;
+  work.type = fast ? Umap::WorkItem::WorkType::FAST_EVICT : Umap::WorkItem::WorkType::EVICT;
+  work.fill_start = pd->page;
+  work.num_pages = 1;
 
   m_evict_workers->send_work(work);
 }
 
-void EvictManager::schedule_flush(PageDescriptor* pd)
+//
+// Hands pages to the Evict Workers in runs of neighbouring pages of a
+// region, so that each run is written back and released at once.  Runs
+// stop at the end of a userfaultfd stripe, which the write protection of a
+// run cannot span.
+//
+void EvictManager::send_runs(std::vector<PageDescriptor*>& pages, WorkItem::WorkType type)
 {
-  WorkItem work = { .page_desc = pd, .type = Umap::WorkItem::WorkType::FLUSH };
+  std::sort(pages.begin(), pages.end(),
+      [](const PageDescriptor* a, const PageDescriptor* b) {
+        return a->region != b->region ? a->region < b->region : a->page < b->page;
+      });
+
+  uint64_t psize = RegionManager::getInstance().get_umap_page_size();
+
+  for ( std::size_t i = 0; i < pages.size(); ) {
+    PageDescriptor* pd = pages[i];
+    RegionDescriptor* rd = pd->region;
+    uint64_t n = 1;
+
+    while (    i + n < pages.size()
+            && pages[i + n]->region == rd
+            && pages[i + n]->page == pd->page + n * psize
+            && rd->uffd_handler_of(pages[i + n]->page) == rd->uffd_handler_of(pd->page) )
+      ++n;
+
+    WorkItem work = {};
+
+    work.page_desc = pd;
+    work.type = type;
+    work.fill_start = pd->page;
+    work.num_pages = n;
+    m_evict_workers->send_work(work);
+    i += n;
+  }
+}
 
-  m_evict_workers->send_work(work);
+void EvictManager::schedule_flushes(std::vector<PageDescriptor*>& pages)
+{
+  send_runs(pages, Umap::WorkItem::WorkType::FLUSH);
 }
 
 EvictManager::EvictManager( void ) :
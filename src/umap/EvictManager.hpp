@@ -7,6 +7,8 @@
 #ifndef _UMAP_EvictManager_HPP
 #define _UMAP_EvictManager_HPP
 
+#include <vector>
+
 #include "umap/EvictWorkers.hpp"
 
 #include "umap/Buffer.hpp"
@@ -21,8 +23,8 @@ namespace Umap {
     public:
       EvictManager( void );
       ~EvictManager( void );
-      void schedule_eviction(PageDescriptor* pd);
-      void schedule_flush(PageDescriptor* pd);
+      void schedule_eviction(PageDescriptor* pd, bool fast = false);
+      void schedule_flushes(std::vector<PageDescriptor*>& pages);
       void EvictAll( void );
       void WaitAll( void );
 
@@ -31,6 +33,7 @@ namespace Umap {
       EvictWorkers* m_evict_workers;
 
       void EvictMgr(void);
+      void send_runs(std::vector<PageDescriptor*>& pages, WorkItem::WorkType type);
       void ThreadEntry( void );
   };
 } // end of namespace Umap
@@ -0,0 +1,400 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>      // std::min(), std::max(), std::sort()
+#include <list>
+#include <strings.h>      // strcasecmp()
+#include <unordered_map>
+
+#include "umap/EvictPolicy.hpp"
+#include "umap/PageList.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+//
+// The addresses of recently evicted pages, with constant time lookup and
+// removal.  The front of the list holds the most recently added address.
+//
+class GhostList {
+  public:
+    void push_front( char* page ) {
+      erase(page);
+      m_list.push_front(page);
+      m_index[page] = m_list.begin();
+    }
+
+    bool erase( char* page ) {
+      auto it = m_index.find(page);
+
+      if ( it == m_index.end() )
+        return false;
+
+      m_list.erase(it->second);
+      m_index.erase(it);
+      return true;
+    }
+
+    void pop_back( void ) {
+      m_index.erase(m_list.back());
+      m_list.pop_back();
+    }
+
+    uint64_t size( void ) { return m_index.size(); }
+
+  private:
+    std::list<char*> m_list;
+    std::unordered_map<char*, std::list<char*>::iterator> m_index;
+};
+
+//
+// Returns the oldest page of the list that may be evicted, removing it from
+// the list, or nullptr if there is none.  Pages that may not be evicted are
+// passed over where they are.
+//
+static PageDescriptor* take_oldest(PageList& l, const EvictPolicy::Evictable& evictable)
+{
+  for ( auto pd = l.back(); pd != nullptr; pd = pd->prev ) {
+    if ( evictable(pd) ) {
+      l.erase(pd);
+      return pd;
+    }
+  }
+  return nullptr;
+}
+
+static void trim(GhostList& l, uint64_t max)
+{
+  while ( l.size() > max )
+    l.pop_back();
+}
+
+//
+// Pages are evicted in the order that they were brought in.
+//
+class FifoPolicy : public EvictPolicy {
+  public:
+    FifoPolicy( uint64_t capacity ) : EvictPolicy(capacity), m_pages(1) {}
+
+    void insert( PageDescriptor* pd ) { m_pages.push_front(pd); }
+    void hit( PageDescriptor* ) {}
+    bool remove( PageDescriptor* pd ) { return m_pages.erase(pd); }
+
+    void select_victims(   std::size_t max
+                         , const Evictable& evictable
+                         , std::vector<PageDescriptor*>& victims )
+    {
+      PageDescriptor* pd;
+
+      for ( ; max && (pd = take_oldest(m_pages, evictable)) != nullptr; --max )
+        victims.push_back(pd);
+    }
+
+    void pages( std::vector<PageDescriptor*>& out ) { m_pages.pages(out); }
+
+    uint64_t size( void ) { return m_pages.size(); }
+
+  private:
+    PageList m_pages;
+};
+
+//
+// Second chance: the back of the list is the clock hand.  A page that has
+// been referenced since the hand last passed it has its reference cleared
+// and is moved to the front of the list instead of being evicted.  At most
+// one trip around the list is made, so a shard in which every page is
+// referenced still gives up pages.
+//
+// When the hardware accessed bit can be read, it is read for the pages
+// nearest the hand, twice as many as are to be evicted, before each sweep.
+// Pages further along are judged only by the faults seen on them.
+//
+class ClockPolicy : public EvictPolicy {
+  public:
+    ClockPolicy( uint64_t capacity ) : EvictPolicy(capacity), m_pages(1) {}
+
+    void insert( PageDescriptor* pd ) {
+      pd->referenced = false;
+      m_pages.push_front(pd);
+    }
+
+    void hit( PageDescriptor* pd ) { pd->referenced = true; }
+    bool remove( PageDescriptor* pd ) { return m_pages.erase(pd); }
+
+    void pages_to_sample( std::size_t max, std::vector<char*>& pages ) {
+      std::size_t n = 2 * max;
+
+      for ( auto pd = m_pages.back(); pd != nullptr && n; pd = pd->prev, --n )
+        pages.push_back(pd->page);
+    }
+
+    void sampled( std::size_t max, std::vector<char*>& accessed ) {
+      std::size_t n = 2 * max;
+
+      std::sort(accessed.begin(), accessed.end());
+
+      for ( auto pd = m_pages.back(); pd != nullptr && n; pd = pd->prev, --n )
+        if ( std::binary_search(accessed.begin(), accessed.end(), pd->page) )
+          pd->referenced = true;
+    }
+
+    void select_victims(   std::size_t max
+                         , const Evictable& evictable
+                         , std::vector<PageDescriptor*>& victims )
+    {
+      uint64_t chances = m_pages.size();
+      PageDescriptor* hand = nullptr;     // Page after the hand, nullptr at the back
+
+      while ( max ) {
+        PageDescriptor* pd = (hand != nullptr) ? hand->prev : m_pages.back();
+
+        if ( pd == nullptr )
+          break;
+
+        if ( ! evictable(pd) ) {
+          hand = pd;
+          continue;
+        }
+
+        if ( chances && referenced(pd) ) {
+          --chances;
+          ++m_second_chances;
+          m_pages.move_to_front(pd);
+          continue;
+        }
+
+        m_pages.erase(pd);
+        victims.push_back(pd);
+        --max;
+      }
+    }
+
+    void pages( std::vector<PageDescriptor*>& out ) { m_pages.pages(out); }
+
+    uint64_t size( void ) { return m_pages.size(); }
+
+  private:
+    PageList m_pages;
+
+    bool referenced( PageDescriptor* pd ) {
+      bool rval = pd->referenced;
+
+      pd->referenced = false;
+      return rval;
+    }
+};
+
+//
+// Adaptive Replacement Cache (Megiddo and Modha, FAST '03).  Pages seen once
+// live on T1 and pages seen more than once on T2.  The addresses of pages
+// recently evicted from each are remembered on the ghost lists B1 and B2,
+// and a fault on a ghost address moves the target size p of T1 toward
+// whichever list would have kept the page.
+//
+class ArcPolicy : public EvictPolicy {
+  public:
+    ArcPolicy( uint64_t capacity ) : EvictPolicy(capacity), m_t1(1), m_t2(2), m_p(0) {}
+
+    void insert( PageDescriptor* pd ) {
+      uint64_t b1 = m_b1.size();
+      uint64_t b2 = m_b2.size();
+
+      if ( m_b1.erase(pd->page) ) {
+        ++m_ghost_hits;
+        m_p = std::min(m_capacity, m_p + std::max<uint64_t>(b2 / b1, 1));
+        m_t2.push_front(pd);
+      }
+      else if ( m_b2.erase(pd->page) ) {
+        uint64_t delta = std::max<uint64_t>(b1 / b2, 1);
+
+        ++m_ghost_hits;
+        m_p = (m_p > delta) ? m_p - delta : 0;
+        m_t2.push_front(pd);
+      }
+      else {
+        m_t1.push_front(pd);
+      }
+      trim_ghosts();
+    }
+
+    void hit( PageDescriptor* pd ) {
+      if ( m_t1.erase(pd) )
+        m_t2.push_front(pd);
+      else
+        m_t2.move_to_front(pd);
+    }
+
+    bool remove( PageDescriptor* pd ) {
+      return m_t1.erase(pd) || m_t2.erase(pd);
+    }
+
+    void select_victims(   std::size_t max
+                         , const Evictable& evictable
+                         , std::vector<PageDescriptor*>& victims )
+    {
+      for ( ; max; --max ) {
+        bool from_t1 = m_t1.size() && (m_t1.size() > m_p || m_t2.size() == 0);
+        PageDescriptor* pd;
+
+        if ( from_t1 ) {
+          if ( (pd = take_oldest(m_t1, evictable)) != nullptr )
+            m_b1.push_front(pd->page);
+          else if ( (pd = take_oldest(m_t2, evictable)) != nullptr )
+            m_b2.push_front(pd->page);
+        }
+        else {
+          if ( (pd = take_oldest(m_t2, evictable)) != nullptr )
+            m_b2.push_front(pd->page);
+          else if ( (pd = take_oldest(m_t1, evictable)) != nullptr )
+            m_b1.push_front(pd->page);
+        }
+
+        if ( pd == nullptr )
+          break;
+
+        victims.push_back(pd);
+      }
+      trim_ghosts();
+    }
+
+    void pages( std::vector<PageDescriptor*>& out ) {
+      m_t1.pages(out);
+      m_t2.pages(out);
+    }
+
+    uint64_t size( void ) { return m_t1.size() + m_t2.size(); }
+
+    void set_capacity( uint64_t capacity ) {
+      EvictPolicy::set_capacity(capacity);
+      m_p = std::min(m_p, m_capacity);
+      trim_ghosts();
+    }
+
+  private:
+    PageList m_t1;
+    PageList m_t2;
+    GhostList m_b1;
+    GhostList m_b2;
+    uint64_t m_p;     // Target size of T1
+
+    //
+    // Keep |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+    //
+    void trim_ghosts( void ) {
+      uint64_t t1 = m_t1.size();
+      uint64_t resident = t1 + m_t2.size();
+
+      trim(m_b1, (m_capacity > t1) ? m_capacity - t1 : 0);
+
+      if ( resident + m_b1.size() + m_b2.size() > 2 * m_capacity ) {
+        uint64_t room = (2 * m_capacity > resident + m_b1.size())
+                          ? 2 * m_capacity - resident - m_b1.size() : 0;
+        trim(m_b2, room);
+      }
+    }
+};
+
+//
+// Full 2Q (Johnson and Shasha, VLDB '94).  New pages enter the FIFO A1in,
+// where further references are treated as correlated and ignored.  Pages
+// pushed out of A1in leave their address on the ghost list A1out, and only
+// a page faulted in again while on A1out is admitted to the LRU list Am.
+// A sequential scan therefore only ever displaces A1in.
+//
+class TwoQPolicy : public EvictPolicy {
+  public:
+    TwoQPolicy( uint64_t capacity ) : EvictPolicy(capacity), m_a1in(1), m_am(2) {}
+
+    void insert( PageDescriptor* pd ) {
+      if ( m_a1out.erase(pd->page) ) {
+        ++m_ghost_hits;
+        m_am.push_front(pd);
+      }
+      else {
+        m_a1in.push_front(pd);
+      }
+    }
+
+    void hit( PageDescriptor* pd ) { m_am.move_to_front(pd); }
+
+    bool remove( PageDescriptor* pd ) {
+      return m_a1in.erase(pd) || m_am.erase(pd);
+    }
+
+    void select_victims(   std::size_t max
+                         , const Evictable& evictable
+                         , std::vector<PageDescriptor*>& victims )
+    {
+      uint64_t kin = std::max<uint64_t>(m_capacity / 4, 1);
+
+      for ( ; max; --max ) {
+        bool from_a1 = m_a1in.size() && (m_a1in.size() > kin || m_am.size() == 0);
+        PageDescriptor* pd = nullptr;
+
+        if ( from_a1 && (pd = take_oldest(m_a1in, evictable)) != nullptr ) {
+          m_a1out.push_front(pd->page);
+        }
+        else if ( (pd = take_oldest(m_am, evictable)) == nullptr ) {
+          if ( ! from_a1 && (pd = take_oldest(m_a1in, evictable)) != nullptr )
+            m_a1out.push_front(pd->page);
+        }
+
+        if ( pd == nullptr )
+          break;
+
+        victims.push_back(pd);
+      }
+      trim(m_a1out, std::max<uint64_t>(m_capacity / 2, 1));
+    }
+
+    void pages( std::vector<PageDescriptor*>& out ) {
+      m_a1in.pages(out);
+      m_am.pages(out);
+    }
+
+    uint64_t size( void ) { return m_a1in.size() + m_am.size(); }
+
+    void set_capacity( uint64_t capacity ) {
+      EvictPolicy::set_capacity(capacity);
+      trim(m_a1out, std::max<uint64_t>(m_capacity / 2, 1));
+    }
+
+  private:
+    PageList m_a1in;
+    PageList m_am;
+    GhostList m_a1out;
+};
+
+static const char* policy_names[] = { "FIFO", "CLOCK", "ARC", "2Q" };
+
+const char* EvictPolicy::policy_name( const std::string& name )
+{
+  for ( auto n : policy_names )
+    if ( strcasecmp(name.c_str(), n) == 0 )
+      return n;
+
+  return nullptr;
+}
+
+EvictPolicy* EvictPolicy::create( const std::string& name, uint64_t capacity )
+{
+  const char* n = policy_name(name);
+
+  if ( n == nullptr )
+    UMAP_ERROR("Unknown eviction policy: " << name);
+
+  std::string policy(n);
+
+  if ( policy == "CLOCK" )
+    return new ClockPolicy(capacity);
+  else if ( policy == "ARC" )
+    return new ArcPolicy(capacity);
+  else if ( policy == "2Q" )
+    return new TwoQPolicy(capacity);
+
+  return new FifoPolicy(capacity);
+}
+} // end of namespace Umap
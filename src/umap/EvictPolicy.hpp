@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_EvictPolicy_HPP
+#define _UMAP_EvictPolicy_HPP
+
+#include <algorithm>            // std::max()
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "umap/PageDescriptor.hpp"
+
+namespace Umap {
+  //
+  // An EvictPolicy keeps track of the pages of one Buffer shard and decides
+  // which of them to evict.  Every method is called with the shard lock
+  // held.
+  //
+  // A page is added with insert() when a descriptor is handed out for it,
+  // and leaves the policy either by being returned from select_victims()
+  // or through remove().  hit() is called for every fault on a page that is
+  // already present, and may be called for a page the policy no longer
+  // holds if it was taken while the faulting thread waited on its state.
+  //
+  class EvictPolicy {
+    public:
+      typedef std::function<bool(PageDescriptor*)> Evictable;
+
+      static EvictPolicy* create( const std::string& name, uint64_t capacity );
+
+      // Returns the canonical name of a policy, or nullptr if unknown
+      static const char* policy_name( const std::string& name );
+
+      virtual ~EvictPolicy( void ) {}
+
+      virtual void insert( PageDescriptor* pd ) = 0;
+      virtual void hit( PageDescriptor* pd ) = 0;
+      virtual bool remove( PageDescriptor* pd ) = 0;
+
+      //
+      // Moves up to max pages for which evictable() is true out of the
+      // policy and onto the end of victims.
+      //
+      virtual void select_victims(   std::size_t max
+                                   , const Evictable& evictable
+                                   , std::vector<PageDescriptor*>& victims ) = 0;
+
+      //
+      // A policy that uses the hardware accessed bit names the pages that a
+      // select_victims() of up to max pages will look at first, and is then
+      // given those of them that were accessed.  The bits are read between
+      // the two calls, with the shard lock dropped, so the pages named may
+      // have left the policy by then.
+      //
+      virtual void pages_to_sample( std::size_t, std::vector<char*>& ) {}
+      virtual void sampled( std::size_t, std::vector<char*>& ) {}
+
+      virtual void pages( std::vector<PageDescriptor*>& out ) = 0;
+      virtual uint64_t size( void ) = 0;
+
+      //
+      // Number of pages the shard is expected to hold, at least one even
+      // when the buffer has fewer pages than shards
+      //
+      virtual void set_capacity( uint64_t capacity ) { m_capacity = std::max<uint64_t>(1, capacity); }
+
+      uint64_t second_chances( void ) { return m_second_chances; }
+      uint64_t ghost_hits( void ) { return m_ghost_hits; }
+
+    protected:
+      EvictPolicy( uint64_t capacity )
+        : m_capacity(std::max<uint64_t>(1, capacity)), m_second_chances(0), m_ghost_hits(0) {}
+
+      uint64_t m_capacity;
+      uint64_t m_second_chances;  // Referenced pages passed over
+      uint64_t m_ghost_hits;      // Pages brought back in soon after eviction
+  };
+} // end of namespace Umap
+#endif // _UMAP_EvictPolicy_HPP
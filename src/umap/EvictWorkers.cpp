@@ -7,18 +7,23 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <vector>
 
 #include "umap/Buffer.hpp"
 #include "umap/EvictWorkers.hpp"
 #include "umap/RegionManager.hpp"
 #include "umap/Uffd.hpp"
 #include "umap/WorkerPool.hpp"
+#include "umap/store/Store.hpp"
 #include "umap/util/Macros.hpp"
 
 namespace Umap {
 void EvictWorkers::EvictWorker( void )
 {
   uint64_t page_size = RegionManager::getInstance().get_umap_page_size();
+  char* staging = m_uffd->wp_async() ? m_uffd->alloc_staging_pages() : nullptr;
+  std::vector<PageDescriptor*> pages;
+  std::vector<StoreRequest> writes;
 
   while ( 1 ) {
     auto w = get_work();
@@ -28,32 +33,119 @@ void EvictWorkers::EvictWorker( void )
     if ( w.type == Umap::WorkItem::WorkType::EXIT )
       break;    // Time to leave
 
-    auto pd = w.page_desc;
+    RegionDescriptor* rd = w.page_desc->region;
 
-    if ( pd->dirty ) {
-      auto store = pd->region->store();
-      auto offset = pd->region->store_offset(pd->page);
+    pages.clear();
+    for ( uint64_t i = 0; i < w.num_pages; ++i )
+      pages.push_back(i == 0 ? w.page_desc : rd->get_page_descriptor(w.fill_start + i * page_size));
 
-      m_uffd->enable_write_protect(pd->page);
-
-      if (store->write_to_store(pd->page, page_size, offset) == -1)
-        UMAP_ERROR("write_to_store failed: "
-            << errno << " (" << strerror(errno) << ")");
-
-      pd->dirty = false;
+    if (   w.type == Umap::WorkItem::WorkType::EVICT
+        && staging != nullptr && rd->writable() ) {
+      for ( auto pd : pages ) {
+        evict_written_page(pd, staging, page_size);
+        UMAP_LOG(Debug, "Removing page: " << pd);
+        m_buffer->mark_page_as_free(pd);
+      }
+      continue;
     }
 
-    if (w.type == Umap::WorkItem::WorkType::FLUSH)
+    write_back(rd, pages, writes, staging == nullptr, page_size);
+
+    if (w.type == Umap::WorkItem::WorkType::FLUSH) {
+      for ( auto pd : pages )
+        m_buffer->mark_page_as_flushed(pd);
       continue;
+    }
     
     if (w.type != Umap::WorkItem::WorkType::FAST_EVICT) {
-      if (madvise(pd->page, page_size, MADV_DONTNEED) == -1)
+      if (madvise(w.fill_start, w.num_pages * page_size, MADV_DONTNEED) == -1)
         UMAP_ERROR("madvise failed: " << errno << " (" << strerror(errno) << ")");
     }
 
-    UMAP_LOG(Debug, "Removing page: " << w.page_desc);
-    m_buffer->mark_page_as_free(w.page_desc);
+    for ( auto pd : pages ) {
+      UMAP_LOG(Debug, "Removing page: " << pd);
+      m_buffer->mark_page_as_free(pd);
+    }
+  }
+
+  if ( staging != nullptr )
+    m_uffd->free_staging_pages(staging);
+}
+
+//
+// Writes the dirty pages of a run of neighbouring pages of rd back to its
+// store, each run of dirty pages with a single write, and all of them as
+// one batch.  The pages are write protected first, unless asynchronous
+// write protection already did so when they were found to be written.
+// Pages that are not dirty were write protected when they were filled, so
+// the whole run is protected at once.
+//
+void EvictWorkers::write_back(  RegionDescriptor* rd, std::vector<PageDescriptor*>& pages
+                              , std::vector<StoreRequest>& writes, bool protect
+                              , uint64_t page_size )
+{
+  writes.clear();
+
+  for ( auto pd : pages ) {
+    if ( ! pd->dirty )
+      continue;
+
+    off_t offset = rd->store_offset(pd->page);
+
+    if ( writes.size() && writes.back().buf + writes.back().nb == pd->page )
+      writes.back().nb += page_size;
+    else
+      writes.push_back({ pd->page, page_size, offset, 0 });
+  }
+
+  if ( writes.size() == 0 )
+    return;
+
+  if ( protect )
+    m_uffd->enable_write_protect(rd, pages[0]->page, pages.size());
+
+  rd->store()->write_to_store_v(writes.data(), writes.size());
+
+  for ( auto& req : writes ) {
+    if (req.result == -1)
+      UMAP_ERROR("write_to_store failed: "
+          << errno << " (" << strerror(errno) << ")");
+  }
+}
+
+//
+// With asynchronous write protection nothing keeps the application from
+// writing to a page while it is being evicted, so whether it is dirty is
+// only known once it is out of the region.  The page is moved out first,
+// after which accesses to it fault and wait for it to leave.  Moving a page
+// loses its write protection, and with it whether the page was written, so
+// it is always written back.
+//
+void EvictWorkers::evict_written_page( PageDescriptor* pd, char* staging, uint64_t page_size )
+{
+  auto store = pd->region->store();
+  auto offset = pd->region->store_offset(pd->page);
+  char* data = m_uffd->move_out_page(pd->region, pd->page, staging);
+
+  if ( data == nullptr ) {
+    //
+    // Not there means the application gave the page back itself.  A page
+    // that cannot be moved, such as one shared with a child process, is
+    // written back in place, where a racing write may still get past.
+    //
+    if ( errno == ENOENT )
+      return;
+
+    UMAP_LOG(Debug, "UFFDIO_MOVE of " << pd << ": " << strerror(errno));
+    data = pd->page;
   }
+
+  if (store->write_to_store(data, page_size, offset) == -1)
+    UMAP_ERROR("write_to_store failed: "
+        << errno << " (" << strerror(errno) << ")");
+
+  if (madvise(data, page_size, MADV_DONTNEED) == -1)
+    UMAP_ERROR("madvise failed: " << errno << " (" << strerror(errno) << ")");
 }
 
 EvictWorkers::EvictWorkers(uint64_t num_evictors, Buffer* buffer, Uffd* uffd)
@@ -9,10 +9,13 @@
 
 #include "umap/config.h"
 
+#include <vector>
+
 #include "umap/Buffer.hpp"
 #include "umap/PageDescriptor.hpp"
 #include "umap/Uffd.hpp"
 #include "umap/WorkerPool.hpp"
+#include "umap/store/Store.hpp"
 
 namespace Umap {
   class Uffd;
@@ -26,6 +29,9 @@ namespace Umap {
       Uffd* m_uffd;
 
       void EvictWorker( void );
+      void evict_written_page( PageDescriptor* pd, char* staging, uint64_t page_size );
+      void write_back(  RegionDescriptor* rd, std::vector<PageDescriptor*>& pages
+                      , std::vector<StoreRequest>& writes, bool protect, uint64_t page_size );
       void ThreadEntry( void );
   };
 } // end of namespace Umap
@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>            // std::max()
+#include <cstdint>
+#include <errno.h>
+#include <string.h>             // strerror()
+#include <sys/mman.h>           // mmap()
+#include <sys/syscall.h>        // syscall()
+#include <unistd.h>             // syscall()
+
+#include "umap/config.h"
+#include "umap/FillRing.hpp"
+#include "umap/util/Macros.hpp"
+
+#ifdef UMAP_HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+namespace Umap {
+
+FillRing::FillRing( unsigned depth, uint64_t slot_size )
+  :   m_fd(-1), m_depth(depth), m_slot_size(slot_size), m_buffers(nullptr)
+    , m_fixed(false), m_to_submit(0)
+    , m_sq_ring(MAP_FAILED), m_sq_ring_size(0)
+    , m_cq_ring(MAP_FAILED), m_cq_ring_size(0)
+    , m_sqes(MAP_FAILED), m_sqes_size(0)
+    , m_iovecs(new struct iovec[depth])
+{
+  m_buffers = (char*)mmap(nullptr, m_depth * m_slot_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if ( m_buffers == MAP_FAILED )
+    UMAP_ERROR("mmap of " << m_depth * m_slot_size << " bytes failed: " << strerror(errno));
+
+  if ( ! setup() ) {
+    if ( m_fd != -1 )
+      close(m_fd);
+    m_fd = -1;
+  }
+}
+
+FillRing::~FillRing( void )
+{
+  if ( m_sqes != MAP_FAILED )
+    munmap(m_sqes, m_sqes_size);
+
+  if ( m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring )
+    munmap(m_cq_ring, m_cq_ring_size);
+
+  if ( m_sq_ring != MAP_FAILED )
+    munmap(m_sq_ring, m_sq_ring_size);
+
+  if ( m_fd != -1 )
+    close(m_fd);
+
+  munmap(m_buffers, m_depth * m_slot_size);
+  delete [] m_iovecs;
+}
+
+#ifdef UMAP_HAVE_IO_URING
+bool FillRing::setup( void )
+{
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+
+  if ( (m_fd = syscall(__NR_io_uring_setup, m_depth, &p)) < 0 ) {
+    UMAP_LOG(Info, "io_uring_setup: " << strerror(errno));
+    m_fd = -1;
+    return false;
+  }
+
+  m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if ( p.features & IORING_FEAT_SINGLE_MMAP )
+    m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+
+  m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+  if ( m_sq_ring == MAP_FAILED )
+    return false;
+
+  if ( p.features & IORING_FEAT_SINGLE_MMAP )
+    m_cq_ring = m_sq_ring;
+  else
+    m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+  if ( m_cq_ring == MAP_FAILED )
+    return false;
+
+  m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+  if ( m_sqes == MAP_FAILED )
+    return false;
+
+  m_sq_head = (unsigned*)((char*)m_sq_ring + p.sq_off.head);
+  m_sq_tail = (unsigned*)((char*)m_sq_ring + p.sq_off.tail);
+  m_sq_mask = (unsigned*)((char*)m_sq_ring + p.sq_off.ring_mask);
+  m_sq_array = (unsigned*)((char*)m_sq_ring + p.sq_off.array);
+  m_cq_head = (unsigned*)((char*)m_cq_ring + p.cq_off.head);
+  m_cq_tail = (unsigned*)((char*)m_cq_ring + p.cq_off.tail);
+  m_cq_mask = (unsigned*)((char*)m_cq_ring + p.cq_off.ring_mask);
+  m_cqes = (char*)m_cq_ring + p.cq_off.cqes;
+
+  //
+  // Registered buffers spare the kernel mapping them for every read, but
+  // are pinned, which RLIMIT_MEMLOCK may not allow.  Reads into buffers
+  // that are not registered work all the same.
+  //
+  for ( unsigned i = 0; i < m_depth; ++i ) {
+    m_iovecs[i].iov_base = slot_buffer(i);
+    m_iovecs[i].iov_len = m_slot_size;
+  }
+
+  if ( syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_BUFFERS, m_iovecs, m_depth) == 0 )
+    m_fixed = true;
+  else
+    UMAP_LOG(Debug, "IORING_REGISTER_BUFFERS: " << strerror(errno));
+
+  return true;
+}
+
+void FillRing::read( unsigned slot, int fd, uint64_t done, uint64_t nb, off_t off )
+{
+  unsigned tail = *m_sq_tail;
+  unsigned index = tail & *m_sq_mask;
+  struct io_uring_sqe* sqe = &((struct io_uring_sqe*)m_sqes)[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->fd = fd;
+  sqe->off = off;
+  sqe->user_data = slot;
+
+  if ( m_fixed ) {
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->addr = (uint64_t)(slot_buffer(slot) + done);
+    sqe->len = nb;
+    sqe->buf_index = slot;
+  }
+  else {
+    m_iovecs[slot].iov_base = slot_buffer(slot) + done;
+    m_iovecs[slot].iov_len = nb;
+    sqe->opcode = IORING_OP_READV;
+    sqe->addr = (uint64_t)&m_iovecs[slot];
+    sqe->len = 1;
+  }
+
+  m_sq_array[index] = index;
+  __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++m_to_submit;
+}
+
+void FillRing::submit( void )
+{
+  do {
+    int rval = syscall(__NR_io_uring_enter, m_fd, m_to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+    if ( rval == -1 ) {
+      if ( errno == EINTR || errno == EAGAIN )
+        continue;
+
+      UMAP_ERROR("io_uring_enter failed: " << strerror(errno));
+    }
+
+    m_to_submit -= rval;
+  } while ( m_to_submit );
+}
+
+bool FillRing::complete( unsigned& slot, int& res )
+{
+  unsigned head = *m_cq_head;
+
+  if ( head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) )
+    return false;
+
+  struct io_uring_cqe* cqe = &((struct io_uring_cqe*)m_cqes)[head & *m_cq_mask];
+
+  slot = (unsigned)cqe->user_data;
+  res = cqe->res;
+
+  __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+#else
+bool FillRing::setup( void )
+{
+  UMAP_LOG(Info, "umap was built without io_uring");
+  return false;
+}
+
+void FillRing::read( unsigned, int, uint64_t, uint64_t, off_t ) {}
+void FillRing::submit( void ) {}
+bool FillRing::complete( unsigned&, int& ) { return false; }
+#endif // UMAP_HAVE_IO_URING
+} // end of namespace Umap
@@ -0,0 +1,83 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_FillRing_HPP
+#define _UMAP_FillRing_HPP
+
+#include <cstdint>
+#include <sys/types.h>          // off_t
+#include <sys/uio.h>            // struct iovec
+
+#include "umap/config.h"
+
+namespace Umap {
+  //
+  // An io_uring of a Fill worker, used through the system calls directly
+  // rather than liburing.  Each of its depth slots has a buffer of its own,
+  // registered with the kernel when it allows, into which one read at a
+  // time is done.
+  //
+  class FillRing {
+    public:
+      FillRing( unsigned depth, uint64_t slot_size );
+      ~FillRing( void );
+
+      //
+      // False if io_uring could not be set up, in which case the ring must
+      // not be used
+      //
+      bool ok( void ) { return m_fd != -1; }
+
+      unsigned depth( void ) { return m_depth; }
+      uint64_t slot_size( void ) { return m_slot_size; }
+      char* slot_buffer( unsigned slot ) { return m_buffers + slot * m_slot_size; }
+
+      //
+      // Queues a read of nb bytes at off of fd into the buffer of slot,
+      // starting done bytes into it.  Reads are only started by submit().
+      //
+      void read( unsigned slot, int fd, uint64_t done, uint64_t nb, off_t off );
+
+      //
+      // Starts the reads queued and waits for at least one to complete
+      //
+      void submit( void );
+
+      //
+      // Returns false once there are no more completions to reap
+      //
+      bool complete( unsigned& slot, int& res );
+
+    private:
+      int       m_fd;
+      unsigned  m_depth;
+      uint64_t  m_slot_size;
+      char*     m_buffers;
+      bool      m_fixed;          // Buffers are registered
+      unsigned  m_to_submit;
+
+      void*     m_sq_ring;
+      uint64_t  m_sq_ring_size;
+      void*     m_cq_ring;
+      uint64_t  m_cq_ring_size;
+      void*     m_sqes;
+      uint64_t  m_sqes_size;
+
+      unsigned* m_sq_head;
+      unsigned* m_sq_tail;
+      unsigned* m_sq_mask;
+      unsigned* m_sq_array;
+      unsigned* m_cq_head;
+      unsigned* m_cq_tail;
+      unsigned* m_cq_mask;
+      void*     m_cqes;
+
+      struct iovec* m_iovecs;     // Per slot, for unregistered buffers
+
+      bool setup( void );
+  };
+} // end of namespace Umap
+#endif // _UMAP_FillRing_HPP
@@ -6,12 +6,14 @@
 //////////////////////////////////////////////////////////////////////////////
 #include "umap/config.h"
 
+#include <algorithm>            // std::max()
 #include <cstdint>              // calloc
 #include <errno.h>
 #include <string.h>             // strerror()
 #include <unistd.h>
 
 #include "umap/Buffer.hpp"
+#include "umap/FillRing.hpp"
 #include "umap/FillWorkers.hpp"
 #include "umap/RegionManager.hpp"
 #include "umap/Uffd.hpp"
@@ -21,18 +23,28 @@
 
 namespace Umap {
   void FillWorkers::FillWorker( void ) {
-    char* copyin_buf;
+    char* copyin_buf = nullptr;
     uint64_t page_size = RegionManager::getInstance().get_umap_page_size();
-    std::size_t sz = page_size;
+    std::size_t sz = 0;
+    std::vector<WorkItem> run;
 
-    if (posix_memalign((void**)&copyin_buf, page_size, sz)) {
-      UMAP_ERROR("posix_memalign failed to allocated "
-          << sz << " bytes of memory");
-    }
+    fit_copyin_buf(copyin_buf, sz, page_size, page_size);
 
-    if (copyin_buf == nullptr) {
-      UMAP_ERROR("posix_memalign failed to allocated "
-          << sz << " bytes of memory");
+    if ( m_queue_depth > 1 ) {
+      //
+      // Slots are large enough for a fault-around cluster of the default
+      // size, larger fills are read in place as before
+      //
+      FillRing ring(  m_queue_depth
+                    , std::max(page_size, RegionManager::getInstance().get_fault_around_bytes()));
+
+      if ( ring.ok() ) {
+        fill_with_ring(ring, copyin_buf, sz, page_size);
+        free(copyin_buf);
+        return;
+      }
+
+      UMAP_LOG(Info, "io_uring not available, Fill workers read with pread()");
     }
 
     while ( 1 ) {
@@ -43,28 +55,278 @@ namespace Umap {
       if (w.type == Umap::WorkItem::WorkType::EXIT)
         break;    // Time to leave
 
-      if ( w.page_desc->dirty && w.page_desc->data_present ) {
-        m_uffd->disable_write_protect(w.page_desc->page);
+      uint64_t num_pages = take_run(w, run, m_max_run_pages, page_size);
+
+      fit_copyin_buf(copyin_buf, sz, num_pages * page_size, page_size);
+      fill(run.data(), run.size(), copyin_buf, page_size);
+    }
+
+    free(copyin_buf);
+  }
+
+  //
+  // Starts a run of fills with w, and adds to it the fills waiting on the
+  // queue that continue it on either side, up to max_pages pages in all.
+  // The run stops at the first fill that does not, which is left for
+  // another worker, and at the end of the userfaultfd stripe of w, so that
+  // the pages of the run can be read with one read and copied in with one
+  // copy.  Returns the number of pages in the run.
+  //
+  uint64_t FillWorkers::take_run(  WorkItem& w, std::vector<WorkItem>& run
+                                 , uint64_t max_pages, uint64_t page_size ) {
+    RegionDescriptor* rd = w.page_desc->region;
+    char* start = w.fill_start;
+    char* end = w.fill_start + w.num_pages * page_size;
+    auto handler = rd->uffd_handler_of(start);
+    WorkItem next;
+
+    run.clear();
+    run.push_back(w);
+
+    auto continues_run = [&]( const WorkItem& n ) {
+      if (    n.type == Umap::WorkItem::WorkType::EXIT
+           || n.page_desc->region != rd
+           || (uint64_t)(end - start) / page_size + n.num_pages > max_pages
+           || rd->uffd_handler_of(n.fill_start) != handler )
+        return false;
+
+      return n.fill_start == end || n.fill_start + n.num_pages * page_size == start;
+    };
+
+    while ( try_get_work_if(next, continues_run) ) {
+      if ( next.fill_start == end ) {
+        end += next.num_pages * page_size;
+        run.push_back(next);
       }
       else {
-        uint64_t offset = w.page_desc->region->store_offset(w.page_desc->page);
+        start = next.fill_start;
+        run.insert(run.begin(), next);
+      }
+    }
 
-        if (w.page_desc->region->store()->read_from_store(copyin_buf, page_size, offset) == -1)
-          UMAP_ERROR("read_from_store failed");
+    return (end - start) / page_size;
+  }
+
+  //
+  // Keeps up to ring.depth() reads from the store in flight, each of a run
+  // of fills into a slot of the ring of its own, and copies the pages of
+  // each in as soon as its read completes.  Work is only waited for when no
+  // read is in flight.  Fills from stores that are not kept in a file, and
+  // those too large for a slot, are done in place as without the ring.
+  //
+  void FillWorkers::fill_with_ring(  FillRing& ring, char*& copyin_buf
+                                   , std::size_t& sz, uint64_t page_size ) {
+    struct Read {
+      std::vector<WorkItem> run;
+      int      fd;
+      off_t    off;
+      uint64_t len;
+      uint64_t done;
+    };
+    std::vector<Read> reads(ring.depth());
+    std::vector<unsigned> free_slots;
+    std::vector<WorkItem> run;
+    uint64_t max_run_pages = std::min(m_max_run_pages, ring.slot_size() / page_size);
+    bool exiting = false;
+
+    for ( unsigned slot = ring.depth(); slot > 0; --slot )
+      free_slots.push_back(slot - 1);
+
+    while ( 1 ) {
+      while ( ! exiting && ! free_slots.empty() ) {
+        WorkItem w;
+
+        if ( free_slots.size() == ring.depth() )
+          w = get_work();
+        else if ( ! try_get_work(w) )
+          break;
 
-        if ( ! w.page_desc->dirty ) {
-          m_uffd->copy_in_page_and_write_protect(copyin_buf, w.page_desc->page);
+        UMAP_LOG(Debug, ": " << w << " " << m_buffer);
+
+        if (w.type == Umap::WorkItem::WorkType::EXIT) {
+          exiting = true;   // Once the reads in flight are done
+          break;
         }
-        else {
-          m_uffd->copy_in_page(copyin_buf, w.page_desc->page);
+
+        RegionDescriptor* rd = w.page_desc->region;
+        uint64_t len = take_run(w, run, max_run_pages, page_size) * page_size;
+        int fd;
+        off_t off;
+
+        if (    len > ring.slot_size()
+             || ! rd->store()->read_fd(rd->store_offset(run.front().fill_start), len, &fd, &off) ) {
+          fit_copyin_buf(copyin_buf, sz, len, page_size);
+          fill(run.data(), run.size(), copyin_buf, page_size);
+          continue;
         }
-        w.page_desc->data_present = true;
+
+        unsigned slot = free_slots.back();
+        free_slots.pop_back();
+
+        Read& r = reads[slot];
+        r.run.swap(run);
+        r.fd = fd;
+        r.off = off;
+        r.len = len;
+        r.done = 0;
+        ring.read(slot, fd, 0, len, off);
       }
 
-      m_buffer->mark_page_as_present(w.page_desc);
+      if ( free_slots.size() == ring.depth() ) {
+        if ( exiting )
+          break;
+        continue;
+      }
+
+      ring.submit();
+
+      unsigned slot;
+      int res;
+
+      while ( ring.complete(slot, res) ) {
+        Read& r = reads[slot];
+
+        if ( res < 0 && res != -EAGAIN && res != -EINTR )
+          UMAP_ERROR("io_uring read of " << r.len << " bytes at " << r.off
+              << " failed: " << strerror(-res));
+
+        if ( res > 0 )
+          r.done += res;
+
+        //
+        // Short reads are read again from where they stopped, until the
+        // end of the file
+        //
+        if ( res != 0 && r.done < r.len ) {
+          ring.read(slot, r.fd, r.done, r.len - r.done, r.off + r.done);
+          continue;
+        }
+
+        copy_in(r.run.data(), r.run.size(), ring.slot_buffer(slot), r.done, page_size);
+        free_slots.push_back(slot);
+      }
     }
+  }
+
+  void FillWorkers::fit_copyin_buf(  char*& copyin_buf, std::size_t& sz
+                                   , uint64_t bytes, uint64_t page_size ) {
+    if ( bytes <= sz )
+      return;
 
     free(copyin_buf);
+    sz = bytes;
+
+    if (posix_memalign((void**)&copyin_buf, page_size, sz)) {
+      UMAP_ERROR("posix_memalign failed to allocated "
+          << sz << " bytes of memory");
+    }
+
+    if (copyin_buf == nullptr) {
+      UMAP_ERROR("posix_memalign failed to allocated "
+          << sz << " bytes of memory");
+    }
+  }
+
+  void FillWorkers::fill( WorkItem& w, char* copyin_buf, uint64_t page_size ) {
+    fill(&w, 1, copyin_buf, page_size);
+  }
+
+  //
+  // Fills a run of n contiguous fills, as taken by take_run(), with one read
+  // from the store
+  //
+  void FillWorkers::fill( WorkItem* run, std::size_t n, char* copyin_buf, uint64_t page_size ) {
+    RegionDescriptor* rd = run[0].page_desc->region;
+    char* end = run[n - 1].fill_start + run[n - 1].num_pages * page_size;
+    ssize_t nread = rd->store()->read_from_store(  copyin_buf, end - run[0].fill_start
+                                                 , rd->store_offset(run[0].fill_start));
+
+    if (nread == -1)
+      UMAP_ERROR("read_from_store failed");
+
+    copy_in(run, n, copyin_buf, nread, page_size);
+  }
+
+  //
+  // Copies in the pages of a run of n fills, read into data, of which nread
+  // bytes came from the store
+  //
+  void FillWorkers::copy_in(  WorkItem* run, std::size_t n, char* data
+                            , uint64_t nread, uint64_t page_size ) {
+    uint64_t len = run[n - 1].fill_start + run[n - 1].num_pages * page_size - run[0].fill_start;
+
+    //
+    // The end of the fill may be past the end of the store
+    //
+    if ( nread < len )
+      memset(data + nread, 0, len - nread);
+
+    if ( n > 1 || run[0].num_pages > 1 ) {
+      copy_in_pages(run, n, data, len / page_size, page_size);
+      return;
+    }
+
+    WorkItem& w = run[0];
+
+    if ( ! w.page_desc->dirty ) {
+      //
+      // Threads that faulted on a page being read ahead are woken when
+      // their faults are processed, so that no thread gets ahead of the
+      // handlers.
+      //
+      m_uffd->copy_in_page_and_write_protect(  w.page_desc->region, data, w.page_desc->page
+                                             , w.type != Umap::WorkItem::WorkType::READ_AHEAD);
+    }
+    else {
+      m_uffd->copy_in_page(w.page_desc->region, data, w.page_desc->page);
+    }
+
+    m_buffer->mark_page_as_present(w.page_desc);
+  }
+
+  //
+  // Copies in the pages of a run of fills, read from the store all at once,
+  // with a single copy.  No thread is woken by the copy, threads that
+  // faulted on pages read ahead or faulted around are woken once their
+  // faults find the pages present.
+  //
+  void FillWorkers::copy_in_pages(  WorkItem* run, std::size_t n, char* data
+                                  , uint64_t num_pages, uint64_t page_size ) {
+    RegionDescriptor* rd = run[0].page_desc->region;
+
+    m_uffd->copy_in_pages_and_write_protect(rd, data, run[0].fill_start, num_pages);
+
+    //
+    // A faulting thread may unmap the region once it is woken, which waits
+    // for the pages still being filled, so the pages faulted on are done
+    // last
+    //
+    for ( std::size_t i = 0; i < n; ++i ) {
+      WorkItem& w = run[i];
+
+      for ( uint64_t j = 0; j < w.num_pages; ++j ) {
+        char* page = w.fill_start + j * page_size;
+
+        if ( page != w.page_desc->page )
+          m_buffer->mark_page_as_present(rd->get_page_descriptor(page));
+        else if ( w.type == Umap::WorkItem::WorkType::READ_AHEAD )
+          m_buffer->mark_page_as_present(w.page_desc);
+      }
+    }
+
+    for ( std::size_t i = 0; i < n; ++i ) {
+      WorkItem& w = run[i];
+
+      if ( w.type == Umap::WorkItem::WorkType::READ_AHEAD )
+        continue;
+
+      if ( w.page_desc->dirty )
+        m_uffd->disable_write_protect(rd, w.page_desc->page);
+      else
+        m_uffd->wake_up(rd, w.page_desc->page);
+
+      m_buffer->mark_page_as_present(w.page_desc);
+    }
   }
 
   void FillWorkers::ThreadEntry( void ) {
@@ -75,7 +337,13 @@ namespace Umap {
     :   WorkerPool("Fill Workers", RegionManager::getInstance().get_num_fillers())
       , m_uffd(RegionManager::getInstance().get_uffd_h())
       , m_buffer(RegionManager::getInstance().get_buffer_h())
+      , m_queue_depth(RegionManager::getInstance().get_fill_queue_depth())
   {
+    RegionManager& rm = RegionManager::getInstance();
+
+    m_max_run_pages = std::max(  rm.get_read_ahead()
+                               , rm.get_fault_around_bytes() / rm.get_umap_page_size());
+
     start_thread_pool();
   }
 
@@ -7,7 +7,10 @@
 #ifndef _UMAP_FillWorkers_HPP
 #define _UMAP_FillWorkers_HPP
 
+#include <vector>
+
 #include "umap/Buffer.hpp"
+#include "umap/FillRing.hpp"
 #include "umap/Uffd.hpp"
 #include "umap/WorkerPool.hpp"
 
@@ -20,11 +23,26 @@ namespace Umap {
       FillWorkers( void );
       ~FillWorkers( void );
 
+      //
+      // Fills the page, or run of pages, of w from copyin_buf, which must
+      // hold w.num_pages pages.  The SIGBUS workers (UMAP_SIGBUS) fill
+      // the pages of the faults they resolve with this too.
+      //
+      void fill( WorkItem& w, char* copyin_buf, uint64_t page_size );
+
     private:
       Uffd*    m_uffd;
       Buffer*  m_buffer;
+      uint64_t m_queue_depth;   // Reads in flight per worker with io_uring
+      uint64_t m_max_run_pages; // Largest run of fills read at once
 
       void FillWorker( void );
+      uint64_t take_run( WorkItem& w, std::vector<WorkItem>& run, uint64_t max_pages, uint64_t page_size );
+      void fill_with_ring( FillRing& ring, char*& copyin_buf, std::size_t& sz, uint64_t page_size );
+      void fit_copyin_buf( char*& copyin_buf, std::size_t& sz, uint64_t bytes, uint64_t page_size );
+      void fill( WorkItem* run, std::size_t n, char* copyin_buf, uint64_t page_size );
+      void copy_in( WorkItem* run, std::size_t n, char* data, uint64_t nread, uint64_t page_size );
+      void copy_in_pages( WorkItem* run, std::size_t n, char* data, uint64_t num_pages, uint64_t page_size );
       void ThreadEntry( void );
   };
 } // end of namespace Umap
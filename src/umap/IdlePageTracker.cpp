@@ -0,0 +1,201 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>            // std::sort()
+#include <cstdint>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>             // strerror()
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "umap/IdlePageTracker.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+static const uint64_t PM_PFN_MASK = (1ULL << 55) - 1;
+static const uint64_t PM_PRESENT = 1ULL << 63;
+
+bool IdlePageTracker::get_pfns( char* page, std::vector<uint64_t>& pfns )
+{
+  uint64_t n = m_page_size / m_sys_page_size;
+  off_t off = ((uint64_t)page / m_sys_page_size) * sizeof(uint64_t);
+
+  pfns.resize(n);
+  if ( pread(m_pagemap_fd, &pfns[0], n * sizeof(uint64_t), off) != (ssize_t)(n * sizeof(uint64_t)) )
+    return false;
+
+  for ( auto& e : pfns ) {
+    if ( ! (e & PM_PRESENT) )
+      e = 0;
+    else
+      e &= PM_PFN_MASK;
+  }
+  return true;
+}
+
+void IdlePageTracker::mark_idle( char* page )
+{
+  std::vector<uint64_t> pfns;
+
+  if ( ! get_pfns(page, pfns) )
+    return;
+
+  for ( auto pfn : pfns ) {
+    if ( pfn == 0 )
+      continue;
+
+    uint64_t bits = 1ULL << (pfn % 64);
+    (void)pwrite(m_bitmap_fd, &bits, sizeof(bits), (pfn / 64) * sizeof(bits));
+  }
+}
+
+//
+// Returns the end of the run of sorted PFNs starting at first whose bitmap
+// words follow one another
+//
+static std::size_t
+run_end( const std::vector<std::pair<uint64_t, std::size_t>>& pfns, std::size_t first )
+{
+  std::size_t last = first + 1;
+
+  while ( last < pfns.size() && pfns[last].first / 64 <= pfns[last - 1].first / 64 + 1 )
+    ++last;
+
+  return last;
+}
+
+void IdlePageTracker::test_and_clear_young( std::vector<char*>& pages )
+{
+  std::vector<std::pair<uint64_t, std::size_t>> pfns;  // PFN, index of its page
+  std::vector<uint64_t> page_pfns;
+  std::vector<bool> young(pages.size(), false);
+  std::vector<uint64_t> words;
+
+  for ( std::size_t i = 0; i < pages.size(); ++i ) {
+    if ( ! get_pfns(pages[i], page_pfns) )
+      continue;
+
+    for ( auto pfn : page_pfns )
+      if ( pfn != 0 )
+        pfns.push_back(std::make_pair(pfn, i));
+  }
+
+  std::sort(pfns.begin(), pfns.end());
+
+  for ( std::size_t first = 0, last; first < pfns.size(); first = last ) {
+    last = run_end(pfns, first);
+
+    uint64_t start = pfns[first].first / 64;
+    uint64_t n = pfns[last - 1].first / 64 - start + 1;
+
+    words.resize(n);
+    if ( pread(m_bitmap_fd, &words[0], n * sizeof(uint64_t), start * sizeof(uint64_t))
+          != (ssize_t)(n * sizeof(uint64_t)) )
+      continue;
+
+    for ( std::size_t j = first; j < last; ++j ) {
+      uint64_t pfn = pfns[j].first;
+
+      if ( ! (words[pfn / 64 - start] & (1ULL << (pfn % 64))) )
+        young[pfns[j].second] = true;
+    }
+  }
+
+  //
+  // Only the bits that are set are written, so the words hold just those of
+  // the pages found young
+  //
+  for ( std::size_t first = 0, last; first < pfns.size(); first = last ) {
+    last = run_end(pfns, first);
+
+    uint64_t start = pfns[first].first / 64;
+    uint64_t n = pfns[last - 1].first / 64 - start + 1;
+    bool any = false;
+
+    words.assign(n, 0);
+    for ( std::size_t j = first; j < last; ++j ) {
+      uint64_t pfn = pfns[j].first;
+
+      if ( young[pfns[j].second] ) {
+        words[pfn / 64 - start] |= 1ULL << (pfn % 64);
+        any = true;
+      }
+    }
+
+    if ( any )
+      (void)pwrite(m_bitmap_fd, &words[0], n * sizeof(uint64_t), start * sizeof(uint64_t));
+  }
+
+  std::size_t kept = 0;
+
+  for ( std::size_t i = 0; i < pages.size(); ++i )
+    if ( young[i] )
+      pages[kept++] = pages[i];
+
+  pages.resize(kept);
+}
+
+//
+// Make sure that we can translate one of our own pages to a PFN (which
+// requires CAP_SYS_ADMIN) and read its idle bit.
+//
+bool IdlePageTracker::probe( void )
+{
+  char* page = (char*)mmap(nullptr, m_sys_page_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if ( page == MAP_FAILED )
+    return false;
+
+  uint64_t entry = 0;
+  uint64_t bits;
+  bool ok = false;
+
+  page[0] = 1;
+
+  if ( pread(m_pagemap_fd, &entry, sizeof(entry),
+        ((uint64_t)page / m_sys_page_size) * sizeof(entry)) == sizeof(entry)
+      && (entry & PM_PRESENT) && (entry & PM_PFN_MASK) ) {
+    uint64_t pfn = entry & PM_PFN_MASK;
+    ok = ( pread(m_bitmap_fd, &bits, sizeof(bits), (pfn / 64) * sizeof(bits)) == sizeof(bits) );
+  }
+
+  munmap(page, m_sys_page_size);
+  return ok;
+}
+
+IdlePageTracker::IdlePageTracker( uint64_t page_size )
+  :   m_available(false)
+    , m_pagemap_fd(-1)
+    , m_bitmap_fd(-1)
+    , m_page_size(page_size)
+    , m_sys_page_size(sysconf(_SC_PAGESIZE))
+{
+  if ( (m_pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC)) < 0 ) {
+    UMAP_LOG(Info, "/proc/self/pagemap: " << strerror(errno));
+    return;
+  }
+
+  if ( (m_bitmap_fd = open("/sys/kernel/mm/page_idle/bitmap", O_RDWR | O_CLOEXEC)) < 0 ) {
+    UMAP_LOG(Info, "idle page tracking not available: " << strerror(errno));
+    return;
+  }
+
+  m_available = probe();
+
+  UMAP_LOG(Info, "idle page tracking " << (m_available ? "enabled" : "not permitted"));
+}
+
+IdlePageTracker::~IdlePageTracker( void )
+{
+  if ( m_bitmap_fd >= 0 )
+    close(m_bitmap_fd);
+
+  if ( m_pagemap_fd >= 0 )
+    close(m_pagemap_fd);
+}
+} // end of namespace Umap
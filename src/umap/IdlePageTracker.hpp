@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_IdlePageTracker_HPP
+#define _UMAP_IdlePageTracker_HPP
+
+#include <cstdint>
+#include <vector>
+
+namespace Umap {
+  //
+  // Reads the hardware accessed bit of umap pages through the kernel's idle
+  // page tracking interface (/sys/kernel/mm/page_idle/bitmap).  This
+  // requires CONFIG_IDLE_PAGE_TRACKING and the privilege to read PFNs from
+  // /proc/self/pagemap, so available() must be checked before use.
+  //
+  class IdlePageTracker {
+    public:
+      IdlePageTracker( uint64_t page_size );
+      ~IdlePageTracker( void );
+
+      bool available( void ) { return m_available; }
+
+      void mark_idle( char* page );
+
+      //
+      // Leaves in pages only those accessed since they were last marked
+      // idle, and marks them idle again.  The bitmap is read and written
+      // once for every run of its words that the pages fall in.
+      //
+      void test_and_clear_young( std::vector<char*>& pages );
+
+    private:
+      bool     m_available;
+      int      m_pagemap_fd;
+      int      m_bitmap_fd;
+      uint64_t m_page_size;
+      uint64_t m_sys_page_size;
+
+      bool get_pfns( char* page, std::vector<uint64_t>& pfns );
+      bool probe( void );
+  };
+} // end of namespace Umap
+#endif // _UMAP_IdlePageTracker_HPP
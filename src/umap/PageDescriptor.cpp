@@ -61,8 +61,10 @@ namespace Umap {
 
       if ( pd->dirty )
          os << ", DIRTY";
-      if ( pd->deferred )
-         os << ", DEFERRED";
+      if ( pd->referenced )
+         os << ", REFERENCED";
+      if ( pd->pinned )
+         os << ", PINNED";
       if ( pd->spurious_count )
          os << ", spurious: " << pd->spurious_count;
 
@@ -13,15 +13,24 @@
 namespace Umap {
   class RegionDescriptor;
 
+  //
+  // There is a descriptor for every page in the buffer, so the state and
+  // flags are packed into a single word.  Fields sharing that word must only
+  // be written with the shard lock of the page held.
+  //
   struct PageDescriptor {
-    enum State { FREE = 0, FILLING, PRESENT, UPDATING, LEAVING };
+    enum State : unsigned int { FREE = 0, FILLING, PRESENT, UPDATING, LEAVING };
     char*             page;
     RegionDescriptor* region;
-    State             state;
-    bool              dirty;
-    bool              deferred;
-    bool              data_present;
-    int               spurious_count;
+    PageDescriptor*   prev;           // Links of the PageList holding the page
+    PageDescriptor*   next;
+    State             state : 3;
+    bool              dirty : 1;
+    bool              data_present : 1;
+    bool              referenced : 1;
+    bool              pinned : 1;
+    unsigned int      list : 2;       // Id of the PageList, 0 if on none
+    unsigned int      spurious_count : 23;
 
     std::string print_state( void ) const;
     void set_state_free( void );
@@ -31,6 +40,13 @@ namespace Umap {
     void set_state_leaving( void );
   };
 
+  //
+  // The four pointers and the packed word, padded to the alignment of a
+  // pointer: 40 bytes on 64-bit targets
+  //
+  static_assert(sizeof(PageDescriptor) == 5 * sizeof(void*),
+                "PageDescriptor state and flags must pack into one word");
+
   std::ostream& operator<<(std::ostream& os, const Umap::PageDescriptor::State st);
   std::ostream& operator<<(std::ostream& os, const Umap::PageDescriptor* pd);
 } // end of namespace Umap
@@ -0,0 +1,160 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+#include <stdlib.h>             // posix_memalign(), free()
+
+#include "umap/PageDescriptorPool.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+//
+// Slabs are aligned to their size so that the slab of a descriptor can be
+// found from its address.  Descriptors are handed out from the end of the
+// slab that has never been used before those that have been put back, so a
+// new slab is only touched as it fills.  Free descriptors are chained
+// through their page field.
+//
+static const uint64_t SLAB_BYTES = 64 * 1024;
+
+struct PageDescriptorPool::Slab {
+  Slab* prev;                 // On the partial list
+  Slab* next;
+  PageDescriptor* free;
+  uint32_t in_use;
+  uint32_t untouched;         // Descriptors never handed out
+
+  static const uint32_t CAPACITY;
+
+  PageDescriptor* descriptors( void ) { return (PageDescriptor*)(this + 1); }
+  bool full( void ) { return free == nullptr && untouched == 0; }
+};
+
+const uint32_t PageDescriptorPool::Slab::CAPACITY =
+                  (SLAB_BYTES - sizeof(PageDescriptorPool::Slab)) / sizeof(PageDescriptor);
+
+void PageDescriptorPool::get( uint64_t num_pages, std::vector<PageDescriptor*>& pages )
+{
+  pthread_mutex_lock(&m_mutex);
+
+  for ( ; num_pages; --num_pages ) {
+    Slab* slab = m_partial;
+
+    if ( slab == nullptr ) {
+      if ( posix_memalign((void**)&slab, SLAB_BYTES, SLAB_BYTES) != 0 )
+        UMAP_ERROR("Failed to allocate " << SLAB_BYTES << " bytes for page descriptors");
+
+      slab->prev = nullptr;
+      slab->next = nullptr;
+      slab->free = nullptr;
+      slab->in_use = 0;
+      slab->untouched = Slab::CAPACITY;
+      m_partial = slab;
+      ++m_num_slabs;
+    }
+
+    PageDescriptor* pd;
+
+    if ( slab->free != nullptr ) {
+      pd = slab->free;
+      slab->free = (PageDescriptor*)pd->page;
+    }
+    else {
+      pd = &slab->descriptors()[Slab::CAPACITY - slab->untouched--];
+    }
+
+    *pd = PageDescriptor();
+    ++slab->in_use;
+    ++m_num_in_use;
+
+    if ( slab->full() ) {
+      m_partial = slab->next;
+      if ( m_partial != nullptr )
+        m_partial->prev = nullptr;
+      slab->next = nullptr;
+    }
+
+    pages.push_back(pd);
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void PageDescriptorPool::put_locked( PageDescriptor* pd )
+{
+  Slab* slab = (Slab*)((uint64_t)pd & ~(SLAB_BYTES - 1));
+  bool was_full = slab->full();
+
+  pd->page = (char*)slab->free;
+  slab->free = pd;
+  --slab->in_use;
+  --m_num_in_use;
+
+  if ( slab->in_use == 0 ) {
+    if ( ! was_full ) {
+      if ( slab->prev != nullptr )
+        slab->prev->next = slab->next;
+      else
+        m_partial = slab->next;
+
+      if ( slab->next != nullptr )
+        slab->next->prev = slab->prev;
+    }
+
+    free(slab);
+    --m_num_slabs;
+  }
+  else if ( was_full ) {
+    slab->prev = nullptr;
+    slab->next = m_partial;
+    if ( m_partial != nullptr )
+      m_partial->prev = slab;
+    m_partial = slab;
+  }
+}
+
+void PageDescriptorPool::put( PageDescriptor* pd )
+{
+  pthread_mutex_lock(&m_mutex);
+  put_locked(pd);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+void PageDescriptorPool::put( std::vector<PageDescriptor*>& pages )
+{
+  pthread_mutex_lock(&m_mutex);
+  for ( auto pd : pages )
+    put_locked(pd);
+  pthread_mutex_unlock(&m_mutex);
+
+  pages.clear();
+}
+
+PageDescriptorPool::PageDescriptorPool( void )
+  : m_partial(nullptr), m_num_slabs(0), m_num_in_use(0)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+//
+// Slabs still holding descriptors in use are not reachable from here, so
+// every descriptor must have been put back by now.
+//
+PageDescriptorPool::~PageDescriptorPool( void )
+{
+  if ( m_num_in_use )
+    UMAP_LOG(Warning, m_num_in_use << " page descriptors were not returned");
+
+  while ( m_partial != nullptr ) {
+    Slab* slab = m_partial;
+    m_partial = slab->next;
+    free(slab);
+  }
+
+  pthread_mutex_destroy(&m_mutex);
+}
+} // end of namespace Umap
@@ -0,0 +1,51 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_PageDescriptorPool_HPP
+#define _UMAP_PageDescriptorPool_HPP
+
+#include <cstdint>
+#include <pthread.h>
+#include <vector>
+
+#include "umap/PageDescriptor.hpp"
+
+namespace Umap {
+  //
+  // Allocates page descriptors in fixed size slabs as they are needed, and
+  // frees a slab as soon as none of its descriptors are in use, so that the
+  // memory used for descriptors follows the number of pages actually in the
+  // buffer rather than its maximum size.
+  //
+  // A descriptor returned to the pool may be freed along with its slab, so
+  // it must not be looked at again once it has been put back.
+  //
+  class PageDescriptorPool {
+    public:
+      PageDescriptorPool( void );
+      ~PageDescriptorPool( void );
+
+      // Appends num_pages zeroed descriptors to pages
+      void get( uint64_t num_pages, std::vector<PageDescriptor*>& pages );
+
+      void put( PageDescriptor* pd );
+      void put( std::vector<PageDescriptor*>& pages );
+
+      uint64_t num_in_use( void ) { return m_num_in_use; }
+      uint64_t num_slabs( void ) { return m_num_slabs; }
+
+    private:
+      struct Slab;
+
+      pthread_mutex_t m_mutex;
+      Slab* m_partial;              // Slabs with descriptors left to hand out
+      uint64_t m_num_slabs;
+      uint64_t m_num_in_use;
+
+      void put_locked( PageDescriptor* pd );
+  };
+} // end of namespace Umap
+#endif // _UMAP_PageDescriptorPool_HPP
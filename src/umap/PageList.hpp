@@ -0,0 +1,91 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_PageList_HPP
+#define _UMAP_PageList_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "umap/PageDescriptor.hpp"
+
+namespace Umap {
+  //
+  // A list of page descriptors linked through their own prev and next
+  // fields, so that adding, removing and moving pages never allocates.  The
+  // front of the list holds the most recently added page, and prev points
+  // toward it.
+  //
+  // A page is on at most one list at a time.  Each list of a shard has its
+  // own id, which is kept in the list field of the pages on it: the
+  // eviction policies use ids 1 and 2 and the pinned pages of the shard use
+  // id 3.  As with the rest of the descriptor, the links may only be changed
+  // with the shard lock held.
+  //
+  class PageList {
+    public:
+      PageList( unsigned int id ) : m_id(id), m_head(nullptr), m_tail(nullptr), m_size(0) {}
+
+      bool contains( PageDescriptor* pd ) { return pd->list == m_id; }
+
+      void push_front( PageDescriptor* pd ) {
+        erase(pd);
+
+        pd->list = m_id;
+        pd->prev = nullptr;
+        pd->next = m_head;
+
+        if ( m_head != nullptr )
+          m_head->prev = pd;
+        else
+          m_tail = pd;
+
+        m_head = pd;
+        ++m_size;
+      }
+
+      bool erase( PageDescriptor* pd ) {
+        if ( ! contains(pd) )
+          return false;
+
+        if ( pd->prev != nullptr )
+          pd->prev->next = pd->next;
+        else
+          m_head = pd->next;
+
+        if ( pd->next != nullptr )
+          pd->next->prev = pd->prev;
+        else
+          m_tail = pd->prev;
+
+        pd->list = 0;
+        pd->prev = pd->next = nullptr;
+        --m_size;
+        return true;
+      }
+
+      void move_to_front( PageDescriptor* pd ) {
+        if ( contains(pd) && pd != m_head )
+          push_front(pd);
+      }
+
+      PageDescriptor* front( void ) { return m_head; }
+      PageDescriptor* back( void ) { return m_tail; }
+      uint64_t size( void ) { return m_size; }
+
+      void pages( std::vector<PageDescriptor*>& out ) {
+        for ( auto pd = m_head; pd != nullptr; pd = pd->next )
+          out.push_back(pd);
+      }
+
+    private:
+      unsigned int m_id;
+      PageDescriptor* m_head;
+      PageDescriptor* m_tail;
+      uint64_t m_size;
+  };
+} // end of namespace Umap
+#endif // _UMAP_PageList_HPP
@@ -0,0 +1,332 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>      // std::min(), std::max()
+#include <errno.h>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <time.h>
+#include <unistd.h>       // access()
+
+#include "umap/Buffer.hpp"
+#include "umap/PressureMonitor.hpp"
+#include "umap/RegionManager.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+static const uint64_t SHRINK_PERCENT = 10;     // Of the current size, per sample
+static const uint64_t GROW_PERCENT = 10;       // Of the configured size, per step
+static const uint64_t MIN_SIZE_PERCENT = 10;   // Of the configured size
+static const int CALM_SAMPLES_TO_GROW = 3;
+
+//
+// cgroup v1 reports "no limit" as a very large number rather than "max"
+//
+static const uint64_t UNLIMITED = 1ULL << 62;
+
+static bool file_exists( const std::string& path )
+{
+  return access(path.c_str(), R_OK) == 0;
+}
+
+static bool read_value( const std::string& path, uint64_t* val )
+{
+  std::ifstream file(path);
+  std::string token;
+
+  if ( ! (file >> token) )
+    return false;
+
+  if ( token == "max" ) {
+    *val = UINT64_MAX;
+    return true;
+  }
+
+  std::stringstream ss(token);
+  return (bool)(ss >> *val);
+}
+
+//
+// Find the directory holding the memory controller files of our cgroup.
+// The path given in /proc/self/cgroup is relative to the cgroup namespace
+// root, which is usually, but not always, what is mounted at
+// /sys/fs/cgroup, so the mount point itself is tried as well.
+//
+static std::string cgroup_memory_dir( bool* v2 )
+{
+  std::ifstream file("/proc/self/cgroup");
+  std::string line;
+  std::string v1_path, v2_path;
+  bool have_v1 = false, have_v2 = false;
+
+  while ( std::getline(file, line) ) {
+    // hierarchy-ID:controller-list:cgroup-path
+    auto first = line.find(':');
+    auto second = line.find(':', first + 1);
+
+    if ( first == std::string::npos || second == std::string::npos )
+      continue;
+
+    std::string controllers = line.substr(first + 1, second - first - 1);
+    std::string path = line.substr(second + 1);
+
+    if ( controllers.empty() ) {
+      v2_path = path;
+      have_v2 = true;
+      continue;
+    }
+
+    std::stringstream ss(controllers);
+    std::string c;
+    while ( std::getline(ss, c, ',') ) {
+      if ( c == "memory" ) {
+        v1_path = path;
+        have_v1 = true;
+      }
+    }
+  }
+
+  if ( have_v1 ) {
+    for ( auto dir : { "/sys/fs/cgroup/memory" + v1_path, std::string("/sys/fs/cgroup/memory") } ) {
+      if ( file_exists(dir + "/memory.limit_in_bytes") ) {
+        *v2 = false;
+        return dir;
+      }
+    }
+  }
+
+  if ( have_v2 ) {
+    for ( auto dir : { "/sys/fs/cgroup" + v2_path, std::string("/sys/fs/cgroup") } ) {
+      if ( file_exists(dir + "/memory.max") ) {
+        *v2 = true;
+        return dir;
+      }
+    }
+  }
+
+  return "";
+}
+
+bool PressureMonitor::cgroup_memory_available( uint64_t* bytes )
+{
+  bool v2;
+  std::string dir = cgroup_memory_dir(&v2);
+  uint64_t limit = UINT64_MAX;
+  uint64_t usage = 0;
+  uint64_t val;
+
+  if ( dir.empty() )
+    return false;
+
+  if ( v2 ) {
+    if ( read_value(dir + "/memory.max", &val) )
+      limit = val;
+    if ( read_value(dir + "/memory.high", &val) )
+      limit = std::min(limit, val);
+    if ( read_value(dir + "/memory.current", &val) )
+      usage = val;
+  }
+  else {
+    if ( read_value(dir + "/memory.limit_in_bytes", &val) )
+      limit = val;
+    if ( read_value(dir + "/memory.usage_in_bytes", &val) )
+      usage = val;
+  }
+
+  if ( limit >= UNLIMITED )
+    return false;
+
+  *bytes = (limit > usage) ? limit - usage : 0;
+
+  UMAP_LOG(Debug, "cgroup " << dir << " limit: " << limit << ", usage: " << usage);
+  return true;
+}
+
+//
+// Sum of the counters of how often the cgroup has run into its limits
+//
+static bool read_limit_events( const std::string& path, uint64_t* count )
+{
+  std::ifstream file(path);
+  std::string key;
+  uint64_t val;
+
+  if ( ! file.is_open() )
+    return false;
+
+  *count = 0;
+
+  // v1 memory.failcnt is a lone counter
+  if ( path.find("failcnt") != std::string::npos )
+    return (bool)(file >> *count);
+
+  while ( file >> key >> val ) {
+    if ( key == "high" || key == "max" || key == "oom" )
+      *count += val;
+  }
+  return true;
+}
+
+//
+// The "some" line of a PSI file reads:
+//   some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+//
+static bool read_pressure( const std::string& path, double* avg10 )
+{
+  std::ifstream file(path);
+  std::string kind, field;
+
+  while ( file >> kind >> field ) {
+    if ( kind == "some" && field.compare(0, 6, "avg10=") == 0 ) {
+      std::stringstream ss(field.substr(6));
+      return (bool)(ss >> *avg10);
+    }
+    file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  return false;
+}
+
+PressureMonitor::Sample PressureMonitor::sample( void )
+{
+  Sample rval = NORMAL;
+  double avg10;
+  uint64_t events;
+
+  if ( ! m_pressure_file.empty() && read_pressure(m_pressure_file, &avg10) ) {
+    if ( avg10 >= m_high_threshold )
+      rval = PRESSURE;
+    else if ( avg10 < m_low_threshold )
+      rval = CALM;
+
+    UMAP_LOG(Debug, "memory pressure: " << avg10);
+  }
+
+  if ( ! m_events_file.empty() && read_limit_events(m_events_file, &events) ) {
+    if ( events > m_limit_events )
+      rval = PRESSURE;
+    m_limit_events = events;
+  }
+
+  return rval;
+}
+
+void PressureMonitor::adjust( Sample s )
+{
+  uint64_t target = m_rm.get_max_pages_in_buffer();
+  uint64_t size = m_buffer->get_size();
+  uint64_t min_size = std::max<uint64_t>(target * MIN_SIZE_PERCENT / 100, 1);
+
+  if ( s == PRESSURE ) {
+    m_calm_samples = 0;
+
+    uint64_t step = std::max<uint64_t>(size * SHRINK_PERCENT / 100, 1);
+    uint64_t new_size = (size > min_size + step) ? size - step : min_size;
+
+    if ( new_size < size ) {
+      UMAP_LOG(Info, "Memory pressure, shrinking buffer to " << new_size << " pages");
+      m_buffer->resize(new_size);
+    }
+  }
+  else if ( s == CALM ) {
+    if ( ++m_calm_samples >= CALM_SAMPLES_TO_GROW && size < target ) {
+      uint64_t step = std::max<uint64_t>(target * GROW_PERCENT / 100, 1);
+      uint64_t new_size = std::min(target, size + step);
+
+      m_calm_samples = 0;
+      UMAP_LOG(Info, "Memory pressure subsided, growing buffer to " << new_size << " pages");
+      m_buffer->resize(new_size);
+    }
+  }
+  else {
+    m_calm_samples = 0;
+  }
+}
+
+void PressureMonitor::monitor( void )
+{
+  pthread_mutex_lock(&m_mutex);
+
+  while ( m_running ) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += m_interval;
+
+    int err = 0;
+    while ( m_running && err != ETIMEDOUT )
+      err = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+
+    if ( ! m_running )
+      break;
+
+    pthread_mutex_unlock(&m_mutex);
+    adjust(sample());
+    pthread_mutex_lock(&m_mutex);
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+PressureMonitor::PressureMonitor( Buffer* buffer )
+  :   m_rm(RegionManager::getInstance())
+    , m_buffer(buffer)
+    , m_interval(m_rm.get_pressure_monitor_freq())
+    , m_high_threshold(m_rm.get_pressure_high_threshold())
+    , m_low_threshold(m_rm.get_pressure_low_threshold())
+    , m_limit_events(0)
+    , m_calm_samples(0)
+    , m_running(false)
+{
+  bool v2;
+  std::string dir = cgroup_memory_dir(&v2);
+
+  if ( ! dir.empty() && v2 && file_exists(dir + "/memory.pressure") )
+    m_pressure_file = dir + "/memory.pressure";
+  else if ( file_exists("/proc/pressure/memory") )
+    m_pressure_file = "/proc/pressure/memory";
+
+  if ( ! dir.empty() )
+    m_events_file = dir + (v2 ? "/memory.events" : "/memory.failcnt");
+
+  if ( m_events_file.empty() || ! read_limit_events(m_events_file, &m_limit_events) )
+    m_events_file.clear();
+
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_cond, NULL);
+
+  if ( m_pressure_file.empty() && m_events_file.empty() ) {
+    UMAP_LOG(Info, "No memory pressure information available, not monitoring");
+    return;
+  }
+
+  UMAP_LOG(Info, "every " << m_interval << " seconds from "
+      << m_pressure_file << " " << m_events_file);
+
+  m_running = true;
+  int ret = pthread_create(&m_thread, NULL, MonitorThreadEntryFunc, this);
+  if (ret) {
+    UMAP_ERROR("Failed to launch the pressure monitor thread");
+  }
+}
+
+PressureMonitor::~PressureMonitor( void )
+{
+  if ( m_running ) {
+    pthread_mutex_lock(&m_mutex);
+    m_running = false;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_thread, NULL);
+  }
+
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_mutex);
+}
+} // end of namespace Umap
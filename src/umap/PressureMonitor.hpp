@@ -0,0 +1,65 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_PressureMonitor_HPP
+#define _UMAP_PressureMonitor_HPP
+
+#include <cstdint>
+#include <pthread.h>
+#include <string>
+
+namespace Umap {
+  class Buffer;
+  class RegionManager;
+
+  //
+  // Periodically samples memory pressure, from the pressure stall
+  // information (PSI) of our cgroup or of the system, and from the
+  // memory.events limit counters of our cgroup.  The Buffer is shrunk while
+  // there is pressure and grown back toward its configured size once
+  // pressure has stayed low for a while.
+  //
+  class PressureMonitor {
+    public:
+      PressureMonitor( Buffer* buffer );
+      ~PressureMonitor( void );
+
+      //
+      // Returns false if the memory cgroup of this process has no limit.
+      // Otherwise sets bytes to how much more the cgroup may use before
+      // reaching its limit.  Both cgroup v2 (memory.max and memory.high) and
+      // v1 (memory.limit_in_bytes) are understood.
+      //
+      static bool cgroup_memory_available( uint64_t* bytes );
+
+    private:
+      enum Sample { CALM, NORMAL, PRESSURE };
+
+      RegionManager& m_rm;
+      Buffer* m_buffer;
+      int m_interval;                 // Seconds between samples
+      int m_high_threshold;           // % stalled time to shrink at
+      int m_low_threshold;            // % stalled time to grow at
+      std::string m_pressure_file;
+      std::string m_events_file;
+      uint64_t m_limit_events;        // Last memory.events high+max+oom
+      int m_calm_samples;
+
+      bool m_running;
+      pthread_mutex_t m_mutex;
+      pthread_cond_t m_cond;
+      pthread_t m_thread;
+
+      Sample sample( void );
+      void adjust( Sample s );
+      void monitor( void );
+      static void* MonitorThreadEntryFunc( void* obj ) {
+        ((PressureMonitor*)obj)->monitor();
+        return NULL;
+      }
+  };
+} // end of namespace Umap
+#endif // _UMAP_PressureMonitor_HPP
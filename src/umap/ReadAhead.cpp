@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>            // std::min(), std::max()
+#include <cstdint>
+
+#include "umap/ReadAhead.hpp"
+
+namespace Umap {
+
+const uint64_t ReadAhead::INITIAL_WINDOW;
+
+bool ReadAhead::missed( uint64_t page, uint64_t max_pages, Window& w )
+{
+  if ( max_pages < 2 )
+    return false;
+
+  pthread_mutex_lock(&m_mutex);
+
+  Stream* stream = nullptr;
+  bool marker_hit = false;
+
+  ++m_clock;
+
+  for ( auto& st : m_streams ) {
+    if ( st.last_used && st.window.size && page == st.window.marker ) {
+      stream = &st;
+      marker_hit = true;
+      break;
+    }
+  }
+
+  //
+  // A fault past the last one of a stream but no further than its window
+  // either starts read-ahead for the stream, or shows that the pages read
+  // ahead were skipped or evicted before they were used
+  //
+  for ( int i = 0; stream == nullptr && i < NUM_STREAMS; ++i ) {
+    Stream& st = m_streams[i];
+    uint64_t end = std::max(st.next, st.window.start + st.window.size);
+
+    if ( st.last_used && page >= st.next && page <= end )
+      stream = &st;
+  }
+
+  if ( stream == nullptr ) {
+    //
+    // Not sequential, so this fault may be the start of a new stream in
+    // place of the one that has gone unused the longest
+    //
+    stream = &m_streams[0];
+    for ( auto& st : m_streams )
+      if ( st.last_used < stream->last_used )
+        stream = &st;
+
+    stream->next = page + 1;
+    stream->window.stride = 1;
+    stream->window.size = 0;
+    stream->last_used = m_clock;
+
+    pthread_mutex_unlock(&m_mutex);
+    return false;
+  }
+
+  if ( marker_hit ) {
+    stream->window.start += stream->window.size;
+    stream->window.size = std::min(stream->window.size * 2, max_pages);
+    stream->window.marker = stream->window.start;
+  }
+  else {
+    stream->window.start = page + 1;
+    stream->window.size = std::min(INITIAL_WINDOW, max_pages);
+    stream->window.marker = stream->window.start + stream->window.size / 2;
+  }
+
+  stream->next = page + 1;
+  stream->last_used = m_clock;
+  w = stream->window;
+
+  pthread_mutex_unlock(&m_mutex);
+  return true;
+}
+
+ReadAhead::ReadAhead( void )
+  : m_streams(), m_clock(0)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+ReadAhead::~ReadAhead( void )
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+} // end of namespace Umap
@@ -0,0 +1,62 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_ReadAhead_HPP
+#define _UMAP_ReadAhead_HPP
+
+#include <cstdint>
+#include <pthread.h>
+
+namespace Umap {
+  //
+  // Follows the sequential fault streams of a region and decides which pages
+  // to read ahead of them, much like the on-demand read-ahead of the kernel.
+  // Strided streams are followed per thread by the StridePrefetcher.
+  //
+  // Present pages do not fault, so there is no way to tell when the
+  // application reaches a page that was read ahead.  Instead, one page of
+  // each window, the marker, is left out.  The fault on the marker shows
+  // that the stream is still sequential, and the next window, twice as
+  // large, is read while the application goes through the rest of the
+  // current one.  A fault anywhere else ahead of a stream means the pages
+  // read ahead were not used, and the window of that stream starts small
+  // again.
+  //
+  class ReadAhead {
+    public:
+      struct Window {
+        uint64_t start;   // Page index
+        int64_t stride;   // Pages from one page of the window to the next
+        uint64_t size;    // Pages
+        uint64_t marker;  // Page of the window not to read
+      };
+
+      ReadAhead( void );
+      ~ReadAhead( void );
+
+      //
+      // Called for every fault on a page of the region that is not in the
+      // buffer.  Returns true, with the window to read, when the fault
+      // continues a sequential stream.  Windows are at most max_pages long.
+      //
+      bool missed( uint64_t page, uint64_t max_pages, Window& w );
+
+    private:
+      static const int NUM_STREAMS = 8;
+      static const uint64_t INITIAL_WINDOW = 4;
+
+      struct Stream {
+        uint64_t next;        // Page after the last fault of the stream
+        Window window;        // Empty until the stream is found sequential
+        uint64_t last_used;   // 0 if the stream has never been used
+      };
+
+      pthread_mutex_t m_mutex;
+      Stream m_streams[NUM_STREAMS];
+      uint64_t m_clock;
+  };
+} // end of namespace Umap
+#endif // _UMAP_ReadAhead_HPP
@@ -7,13 +7,16 @@
 #ifndef _UMAP_RegionDescriptor_HPP
 #define _UMAP_RegionDescriptor_HPP
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <errno.h>
 #include <pthread.h>
 #include <string.h>
-#include <unordered_set>
+#include <sys/mman.h>
 
 #include "umap/PageDescriptor.hpp"
+#include "umap/ReadAhead.hpp"
 #include "umap/store/Store.hpp"
 #include "umap/util/Macros.hpp"
 
@@ -22,43 +25,109 @@ namespace Umap {
     public:
       RegionDescriptor(   char* umap_region, uint64_t umap_size
                         , char* mmap_region, uint64_t mmap_size
-                        , Store* store )
+                        , Store* store, uint64_t page_size, bool writable )
         : m_umap_region(umap_region), m_umap_region_size(umap_size)
         , m_mmap_region(mmap_region), m_mmap_region_size(mmap_size)
-        , m_store(store) {}
+        , m_store(store), m_page_size(page_size)
+        , m_num_pages(umap_size / page_size), m_writable(writable)
+        , m_uffd_first_handler(0), m_uffd_stripe_size(umap_size)
+        , m_fault_around_pages(1), m_count(0)
+      {
+        //
+        // The page table has a slot for every page of the region.  It is
+        // reserved rather than committed so that only the parts of the
+        // table covering pages that have actually been touched use memory.
+        //
+        void* table = mmap(nullptr, m_num_pages * sizeof(PageDescriptor*),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
 
-      ~RegionDescriptor( void ) {}
+        if ( table == MAP_FAILED )
+          UMAP_ERROR("Failed to allocate page table for " << m_num_pages
+              << " pages: " << strerror(errno));
+
+        m_page_table = (PageDescriptor**)table;
+      }
+
+      ~RegionDescriptor( void ) {
+        munmap(m_page_table, m_num_pages * sizeof(PageDescriptor*));
+      }
 
       inline uint64_t store_offset( char* addr ) {
         assert("Invalid address for calculating offset" && addr >= start() && addr < end());
         return (uint64_t)(addr - start());
       }
 
-      inline uint64_t size( void )     { return m_umap_region_size;         }
-      inline Store*   store( void )    { return m_store;                    }
-      inline char*    start( void )    { return m_umap_region;              }
-      inline char*    end( void )      { return start() + size();           }
-      inline uint64_t count( void )    { return m_active_pages.size();      }
+      inline uint64_t page_index( char* addr ) {
+        return store_offset(addr) / m_page_size;
+      }
 
-      inline void insert_page_descriptor(PageDescriptor* pd) {
-        m_active_pages.insert(pd);
+      inline uint64_t size( void )      { return m_umap_region_size;         }
+      inline Store*   store( void )     { return m_store;                    }
+      inline char*    start( void )     { return m_umap_region;              }
+      inline char*    end( void )       { return start() + size();           }
+      inline uint64_t num_pages( void ) { return m_num_pages;                }
+      inline uint64_t count( void )     { return m_count;                    }
+      inline ReadAhead& read_ahead( void ) { return m_read_ahead;            }
+
+      //
+      // Pages of regions mapped without PROT_WRITE are never written, so
+      // they are not write protected to find out when they are dirtied
+      //
+      inline bool writable( void )      { return m_writable;                 }
+
+      //
+      // A fault fills the missing pages around it within an aligned
+      // cluster of this many pages, a power of two
+      //
+      inline uint64_t fault_around_pages( void ) { return m_fault_around_pages; }
+
+      inline void set_fault_around( uint64_t bytes ) {
+        uint64_t pages = 1;
+
+        while ( pages * 2 * m_page_size <= bytes )
+          pages *= 2;
+
+        m_fault_around_pages = pages;
       }
 
-      inline void erase_page_descriptor(PageDescriptor* pd) {
-        UMAP_LOG(Debug, "Erasing PD: " << pd);
-        m_active_pages.erase(pd);
+      //
+      // The region is registered with the userfaultfd handlers of Uffd in
+      // stripes of contiguous pages.  Stripe n belongs to handler
+      // first_handler + n, modulo the number of handlers.
+      //
+      inline void set_uffd_stripes( uint64_t first_handler, uint64_t stripe_size ) {
+        m_uffd_first_handler = first_handler;
+        m_uffd_stripe_size = stripe_size;
+      }
+
+      inline uint64_t uffd_stripe_size( void ) { return m_uffd_stripe_size; }
+
+      inline uint64_t uffd_handler_of( char* addr ) {
+        return m_uffd_first_handler + store_offset(addr) / m_uffd_stripe_size;
       }
 
-      inline PageDescriptor* get_next_page_descriptor( void ) {
-        if ( m_active_pages.size() == 0 )
-          return nullptr;
+      //
+      // A slot of the page table is protected by the lock of the Buffer
+      // shard that owns the page.
+      //
+      inline PageDescriptor* get_page_descriptor( char* addr ) {
+        return m_page_table[page_index(addr)];
+      }
 
-        auto it = m_active_pages.begin();
-        auto rval = *it;
-        rval->deferred = false;
-        erase_page_descriptor(rval);
+      inline void insert_page_descriptor(PageDescriptor* pd) {
+        m_page_table[page_index(pd->page)] = pd;
+        ++m_count;
+      }
+
+      inline void erase_page_descriptor(PageDescriptor* pd) {
+        UMAP_LOG(Debug, "Erasing PD: " << pd);
+        PageDescriptor** slot = &m_page_table[page_index(pd->page)];
 
-        return rval;
+        if ( *slot == pd ) {
+          *slot = nullptr;
+          --m_count;
+        }
       }
 
     private:
@@ -67,8 +136,16 @@ namespace Umap {
       char*    m_mmap_region;
       uint64_t m_mmap_region_size;
       Store*   m_store;
+      uint64_t m_page_size;
+      uint64_t m_num_pages;
+      bool     m_writable;
+      uint64_t m_uffd_first_handler;
+      uint64_t m_uffd_stripe_size;
+      ReadAhead m_read_ahead;
+      std::atomic<uint64_t> m_fault_around_pages;
 
-      std::unordered_set<PageDescriptor*> m_active_pages;
+      PageDescriptor** m_page_table;
+      std::atomic<uint64_t> m_count;
   };
 } // end of namespace Umap
 #endif // _UMAP_RegionDescripto_HPP
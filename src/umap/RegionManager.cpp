@@ -7,17 +7,20 @@
 #include "umap/config.h"
 
 #include <cstdint>        // uint64_t
+#include <errno.h>
 #include <fstream>        // for reading meminfo
 #include <mutex>
 #include <stdlib.h>       // getenv()
 #include <sstream>        // string to integer operations
 #include <string>         // string to integer operations
+#include <sys/mman.h>     // PROT_WRITE
 #include <thread>         // for max_concurrency
 #include <unordered_map>
 #include <unistd.h>       // sysconf()
 
 #include "umap/Buffer.hpp"
 #include "umap/EvictManager.hpp"
+#include "umap/EvictPolicy.hpp"
 #include "umap/FillWorkers.hpp"
 #include "umap/RegionManager.hpp"
 #include "umap/RegionDescriptor.hpp"
@@ -35,7 +38,7 @@ RegionManager::getInstance( void )
 }
 
 void
-RegionManager::addRegion(Store* store, char* region, uint64_t region_size, char* mmap_region, uint64_t mmap_region_size)
+RegionManager::addRegion(Store* store, char* region, uint64_t region_size, char* mmap_region, uint64_t mmap_region_size, int prot)
 {
   std::lock_guard<std::mutex> lock(m_mutex);
 
@@ -45,9 +48,17 @@ RegionManager::addRegion(Store* store, char* region, uint64_t region_size, char*
     m_uffd = new Uffd();
     m_fill_workers = new FillWorkers();
     m_evict_manager = new EvictManager();
+
+    if ( m_pressure_monitor_freq > 0 )
+      m_pressure_monitor = new PressureMonitor(m_buffer);
+
+    if ( m_dirty_background_ratio > 0 )
+      m_writeback_daemon = new WritebackDaemon(m_buffer);
   }
 
-  auto rd = new RegionDescriptor(region, region_size, mmap_region, mmap_region_size, store);
+  auto rd = new RegionDescriptor(  region, region_size, mmap_region, mmap_region_size, store, m_umap_page_size
+                                 , (prot & PROT_WRITE) != 0);
+  rd->set_fault_around(m_fault_around_bytes);
   m_active_regions[(void*)region] = rd;
 
   UMAP_LOG(Debug,
@@ -83,6 +94,8 @@ RegionManager::removeRegion( char* region )
   m_last_iter = m_active_regions.end();
 
   if ( m_active_regions.empty() ) {
+    delete m_writeback_daemon; m_writeback_daemon = nullptr;
+    delete m_pressure_monitor; m_pressure_monitor = nullptr;
     delete m_evict_manager; m_evict_manager = nullptr;
     delete m_fill_workers; m_fill_workers = nullptr;
     delete m_uffd; m_uffd = nullptr;
@@ -90,11 +103,34 @@ RegionManager::removeRegion( char* region )
   }
 }
 
+//
+// With asynchronous write protection, marks the pages written since the
+// last look as dirty.  Called by the writeback daemon, which gives up
+// rather than wait while regions are being added or removed, since the
+// removal of the last region waits for the daemon to stop.
+//
+void
+RegionManager::harvest_written_pages( void )
+{
+  if ( ! m_uffd->wp_async() || ! m_mutex.try_lock() )
+    return;
+
+  for ( auto it : m_active_regions )
+    m_buffer->harvest_written_pages(it.second, true);
+
+  m_mutex.unlock();
+}
+
 int 
 RegionManager::flush_buffer(){
 
   std::lock_guard<std::mutex> lock(m_mutex);
 
+  if ( m_uffd->wp_async() ) {
+    for ( auto it : m_active_regions )
+      m_buffer->harvest_written_pages(it.second, true);
+  }
+
   m_buffer->flush_dirty_pages();
 
   return 0;
@@ -106,6 +142,42 @@ RegionManager::fetch_and_pin( char* paddr, uint64_t size )
   m_buffer->fetch_and_pin(paddr, size);
 }
 
+int
+RegionManager::pin( char* paddr, uint64_t size )
+{
+  if ( m_buffer == nullptr ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return m_buffer->pin(paddr, size);
+}
+
+int
+RegionManager::unpin( char* paddr, uint64_t size )
+{
+  if ( m_buffer == nullptr ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return m_buffer->unpin(paddr, size);
+}
+
+int
+RegionManager::set_fault_around( char* paddr, uint64_t bytes )
+{
+  auto rd = containing_region(paddr);
+
+  if ( rd == nullptr ) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rd->set_fault_around(bytes);
+  return 0;
+}
+
 
 void
 RegionManager::prefetch(int npages, umap_prefetch_item* page_array)
@@ -121,6 +193,10 @@ RegionManager::RegionManager()
   m_version.patch = UMAP_VERSION_PATCH;
 
   m_last_iter = m_active_regions.end();
+  m_buffer = nullptr;
+  m_uffd = nullptr;
+  m_pressure_monitor = nullptr;
+  m_writeback_daemon = nullptr;
 
   m_system_page_size = sysconf(_SC_PAGESIZE);
 
@@ -139,11 +215,37 @@ RegionManager::RegionManager()
   else
     set_num_fillers(nthreads);
 
+  if ( (read_env_var("UMAP_FILL_QUEUE_DEPTH", &env_value)) != nullptr )
+    m_fill_queue_depth = env_value;
+  else
+    m_fill_queue_depth = 1;
+
   if ( (read_env_var("UMAP_PAGE_EVICTORS", &env_value)) != nullptr )
     set_num_evictors(env_value);
   else
     set_num_evictors(nthreads);
 
+  if ( (read_env_var("UMAP_BUFFER_SHARDS", &env_value)) != nullptr )
+    set_num_buffer_shards(env_value);
+  else
+    set_num_buffer_shards(nthreads);
+
+  if ( (read_env_var("UMAP_UFFD_THREADS", &env_value)) != nullptr )
+    set_num_uffd_threads(env_value);
+  else
+    set_num_uffd_threads(1);
+
+  if ( (read_env_var("UMAP_READ_AHEAD", &env_value)) != nullptr )
+    set_read_ahead(env_value);
+  else
+    set_read_ahead(32);
+
+  std::string env_string;
+  if ( (read_env_var("UMAP_EVICT_POLICY", &env_string)) != nullptr )
+    set_evict_policy(env_string);
+  else
+    set_evict_policy("FIFO");
+
   if ( (read_env_var("UMAP_EVICT_HIGH_WATER_THRESHOLD", &env_value)) != nullptr )
     set_evict_high_water_threshold(env_value);
   else
@@ -159,16 +261,75 @@ RegionManager::RegionManager()
   else
     set_umap_page_size(m_system_page_size);
 
-  if ( (read_env_var("UMAP_BUFSIZE", &env_value)) != nullptr )
-    set_max_pages_in_buffer(env_value);
+  if ( (read_env_var("UMAP_FAULT_AROUND_BYTES", &env_value)) != nullptr )
+    m_fault_around_bytes = env_value;
   else
-    set_max_pages_in_buffer( get_max_pages_in_memory() );
+    m_fault_around_bytes = get_umap_page_size();
+
+  if ( (read_env_var("UMAP_WP_ASYNC", &env_value)) != nullptr )
+    m_wp_async = true;
+  else
+    m_wp_async = false;
+
+  if ( (read_env_var("UMAP_SIGBUS", &env_value)) != nullptr )
+    m_sigbus = true;
+  else
+    m_sigbus = false;
+
+  if ( (read_env_var("UMAP_BUFSIZE", &env_value)) == nullptr )
+    env_value = get_max_pages_in_memory();
+
+  if ( set_max_pages_in_buffer(env_value) == -1 ) {
+    UMAP_ERROR("Cannot set maximum pages to "
+        << env_value
+        << " because it must be less than the maximum pages in memory "
+        << get_max_pages_in_memory());
+  }
+
+  if ( (read_env_var("UMAP_PINNED_BUFSIZE", &env_value)) != nullptr )
+    m_max_pinned_pages = env_value;
+  else
+    m_max_pinned_pages = get_max_pages_in_buffer() / 4;
 
   if ( (read_env_var("UMAP_MONITOR_FREQ", &env_value)) != nullptr )
     m_monitor_freq = env_value;
   else
     m_monitor_freq = 0;
 
+  if ( (read_env_var("UMAP_PRESSURE_MONITOR_FREQ", &env_value)) != nullptr )
+    m_pressure_monitor_freq = env_value;
+  else
+    m_pressure_monitor_freq = 0;
+
+  if ( (read_env_var("UMAP_PRESSURE_HIGH_THRESHOLD", &env_value)) != nullptr )
+    m_pressure_high_threshold = env_value;
+  else
+    m_pressure_high_threshold = 10;
+
+  if ( (read_env_var("UMAP_PRESSURE_LOW_THRESHOLD", &env_value)) != nullptr )
+    m_pressure_low_threshold = env_value;
+  else
+    m_pressure_low_threshold = 1;
+
+  if ( (read_env_var("UMAP_DIRTY_RATIO", &env_value)) != nullptr )
+    m_dirty_ratio = std::min(env_value, (uint64_t)100);
+  else
+    m_dirty_ratio = 0;
+
+  //
+  // As with the kernel, a background threshold that is not below the hard
+  // limit is taken to be half of it.  Throttling needs the daemon to write
+  // pages back, so a hard limit alone starts it too.
+  //
+  if ( (read_env_var("UMAP_DIRTY_BACKGROUND_RATIO", &env_value)) != nullptr )
+    m_dirty_background_ratio = std::min(env_value, (uint64_t)100);
+  else
+    m_dirty_background_ratio = 0;
+
+  if (    m_dirty_ratio
+       && (m_dirty_background_ratio == 0 || m_dirty_background_ratio >= m_dirty_ratio) )
+    m_dirty_background_ratio = std::max(m_dirty_ratio / 2, 1);
+
 }
 
 uint64_t
@@ -194,29 +355,56 @@ RegionManager::get_max_pages_in_memory( void )
       // ignore rest of the line
       file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
     }
+
+    //
+    // Inside a container the limit of our memory cgroup may be well below
+    // what the system has free
+    //
+    uint64_t cgroup_avail;
+    if ( PressureMonitor::cgroup_memory_available(&cgroup_avail)
+        && cgroup_avail / oneK < total_mem_kb ) {
+      UMAP_LOG(Info, "Limiting buffer to cgroup memory available: " << cgroup_avail);
+      total_mem_kb = cgroup_avail / oneK;
+    }
   }
   return ( ((total_mem_kb / (get_umap_page_size() / oneK)) * percent) / 100 );
 }
 
-void
+//
+// Returns -1 with errno set to EINVAL if max_pages is 0 or more than fits
+// in memory
+//
+int
 RegionManager::set_max_pages_in_buffer( uint64_t max_pages )
 {
   uint64_t max_pages_in_mem = get_max_pages_in_memory();
   uint64_t old_max_pages_in_buffer = get_max_pages_in_buffer();
 
-  if ( max_pages > max_pages_in_mem ) {
-    UMAP_ERROR("Cannot set maximum pages to "
-        << max_pages
-        << " because it must be less than the maximum pages in memory "
+  if ( max_pages == 0 || max_pages > max_pages_in_mem ) {
+    UMAP_LOG(Info, "Cannot set maximum pages to " << max_pages
+        << ", it must be between 1 and the maximum pages in memory "
         << max_pages_in_mem);
+    errno = EINVAL;
+    return -1;
   }
 
+  std::lock_guard<std::mutex> lock(m_mutex);
+
   m_max_pages_in_buffer = max_pages;
 
+  //
+  // The buffer only exists while there are active regions.  Otherwise the
+  // new size is used when the next one is created.
+  //
+  if ( m_buffer != nullptr )
+    m_buffer->resize(max_pages);
+
   UMAP_LOG(Debug,
     "Maximum pages in page buffer changed from "
     << old_max_pages_in_buffer
     << " to " << get_max_pages_in_buffer() << " pages");
+
+  return 0;
 }
 
 void
@@ -258,6 +446,18 @@ RegionManager::read_env_var( const char* env, uint64_t*  val )
   return nullptr;
 }
 
+std::string*
+RegionManager::read_env_var( const char* env, std::string* val )
+{
+  // return a pointer to val on success, null on failure
+  char* val_ptr = 0;
+  if ( (val_ptr = getenv(env)) && *val_ptr != '\0' ) {
+    *val = val_ptr;
+    return val;
+  }
+  return nullptr;
+}
+
 RegionDescriptor*
 RegionManager::containing_region( char* vaddr )
 {
@@ -310,6 +510,37 @@ RegionManager::set_num_evictors( uint64_t num_evictors )
 {
   m_num_evictors = num_evictors;
 }
+
+void
+RegionManager::set_num_buffer_shards( uint64_t num_shards )
+{
+  m_num_buffer_shards = num_shards;
+}
+
+void
+RegionManager::set_num_uffd_threads( uint64_t num_threads )
+{
+  m_num_uffd_threads = num_threads;
+}
+
+void
+RegionManager::set_read_ahead( uint64_t num_pages )
+{
+  m_read_ahead = num_pages;
+}
+
+void
+RegionManager::set_evict_policy( const std::string& policy )
+{
+  const char* name = EvictPolicy::policy_name(policy);
+
+  if ( name == nullptr )
+    UMAP_ERROR("Unknown eviction policy: " << policy
+        << ", available policies are FIFO, CLOCK, ARC, and 2Q");
+
+  m_evict_policy = name;
+}
+
 void
 RegionManager::set_evict_high_water_threshold( int percent )
 {
@@ -10,11 +10,14 @@
 #include <cstdint>
 #include <mutex>
 #include <map>
+#include <string>
 
 #include "umap/Buffer.hpp"
 #include "umap/EvictManager.hpp"
 #include "umap/FillWorkers.hpp"
+#include "umap/PressureMonitor.hpp"
 #include "umap/Uffd.hpp"
+#include "umap/WritebackDaemon.hpp"
 #include "umap/umap.h"
 #include "umap/store/Store.hpp"
 #include "umap/RegionDescriptor.hpp"
@@ -51,19 +54,38 @@ class RegionManager {
         , uint64_t region_size
         , char*    mmap_region
         , uint64_t mmap_region_size
+        , int      prot
     );
 
     int flush_buffer();
     void prefetch(int npages, umap_prefetch_item* page_array);
     void fetch_and_pin( char* paddr, uint64_t size );
+    int pin( char* paddr, uint64_t size );
+    int unpin( char* paddr, uint64_t size );
+    int set_fault_around( char* paddr, uint64_t bytes );
     void removeRegion( char* mmap_region );
+    int set_max_pages_in_buffer( uint64_t max_pages );
     Version  get_umap_version( void ) { return m_version; }
     long     get_system_page_size( void ) { return m_system_page_size; }
     uint64_t get_max_pages_in_buffer( void ) { return m_max_pages_in_buffer; }
+    uint64_t get_max_pinned_pages( void ) { return m_max_pinned_pages; }
     int      get_monitor_freq( void ) { return m_monitor_freq; }
+    int      get_pressure_monitor_freq( void ) { return m_pressure_monitor_freq; }
+    int      get_pressure_high_threshold( void ) { return m_pressure_high_threshold; }
+    int      get_pressure_low_threshold( void ) { return m_pressure_low_threshold; }
+    int      get_dirty_background_ratio( void ) { return m_dirty_background_ratio; }
+    int      get_dirty_ratio( void ) { return m_dirty_ratio; }
     uint64_t get_umap_page_size( void ) { return m_umap_page_size; }
     uint64_t get_num_fillers( void ) { return m_num_fillers; }
+    uint64_t get_fill_queue_depth( void ) { return m_fill_queue_depth; }
     uint64_t get_num_evictors( void ) { return m_num_evictors; }
+    uint64_t get_num_buffer_shards( void ) { return m_num_buffer_shards; }
+    uint64_t get_num_uffd_threads( void ) { return m_num_uffd_threads; }
+    uint64_t get_read_ahead( void ) { return m_read_ahead; }
+    uint64_t get_fault_around_bytes( void ) { return m_fault_around_bytes; }
+    bool     get_wp_async( void ) { return m_wp_async; }
+    bool     get_sigbus( void ) { return m_sigbus; }
+    const std::string& get_evict_policy( void ) { return m_evict_policy; }
     int get_evict_low_water_threshold( void ) { return m_evict_low_water_threshold; }
     int get_evict_high_water_threshold( void ) { return m_evict_high_water_threshold; }
     uint64_t get_max_fault_events( void ) { return m_max_fault_events; }
@@ -71,17 +93,33 @@ class RegionManager {
     Uffd* get_uffd_h() { return m_uffd; }
     FillWorkers* get_fill_workers_h() { return m_fill_workers; }
     EvictManager* get_evict_manager() { return m_evict_manager; }
+    WritebackDaemon* get_writeback_daemon() { return m_writeback_daemon; }
+    void harvest_written_pages( void );
     RegionDescriptor* containing_region( char* vaddr );
     uint64_t get_num_active_regions( void ) { return (uint64_t)m_active_regions.size(); }
 
   private:
     Version  m_version;
     uint64_t m_max_pages_in_buffer;
+    uint64_t m_max_pinned_pages;
     int      m_monitor_freq;
+    int      m_pressure_monitor_freq;
+    int      m_pressure_high_threshold;
+    int      m_pressure_low_threshold;
+    int      m_dirty_background_ratio;  // 0 if there is no writeback daemon
+    int      m_dirty_ratio;             // 0 if writes are not throttled
     long     m_umap_page_size;
     uint64_t m_system_page_size;
     uint64_t m_num_fillers;
+    uint64_t m_fill_queue_depth;
     uint64_t m_num_evictors;
+    uint64_t m_num_buffer_shards;
+    uint64_t m_num_uffd_threads;
+    uint64_t m_read_ahead;
+    uint64_t m_fault_around_bytes;      // Default for new regions
+    bool     m_wp_async;                // Asked for, the kernel may not have it
+    bool     m_sigbus;                  // Likewise
+    std::string m_evict_policy;
     int m_evict_low_water_threshold;
     int m_evict_high_water_threshold;
     uint64_t m_max_fault_events;
@@ -89,6 +127,8 @@ class RegionManager {
     Uffd* m_uffd;
     FillWorkers* m_fill_workers;
     EvictManager* m_evict_manager;
+    PressureMonitor* m_pressure_monitor;
+    WritebackDaemon* m_writeback_daemon;
     std::mutex m_mutex;
 
     std::map<void*, RegionDescriptor*> m_active_regions;
@@ -97,12 +137,16 @@ class RegionManager {
     RegionManager( void );
 
     uint64_t* read_env_var( const char* env, uint64_t* val);
+    std::string* read_env_var( const char* env, std::string* val);
     uint64_t        get_max_pages_in_memory( void );
     void set_max_fault_events( uint64_t max_events );
-    void set_max_pages_in_buffer( uint64_t max_pages );
     void set_umap_page_size( uint64_t page_size );
     void set_num_fillers( uint64_t num_fillers );
     void set_num_evictors( uint64_t num_evictors );
+    void set_num_buffer_shards( uint64_t num_shards );
+    void set_num_uffd_threads( uint64_t num_threads );
+    void set_read_ahead( uint64_t num_pages );
+    void set_evict_policy( const std::string& policy );
     void set_evict_low_water_threshold( int percent );
     void set_evict_high_water_threshold( int percent );
 };
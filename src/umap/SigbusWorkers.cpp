@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <fcntl.h>              // O_CLOEXEC
+#include <linux/futex.h>        // FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <string.h>             // strerror()
+#include <sys/syscall.h>        // syscall()
+#include <unistd.h>
+
+#include "umap/Uffd.hpp"
+#include "umap/SigbusWorkers.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+//
+// Requests are smaller than PIPE_BUF, so each is written to the pipe at
+// once, and read whole since every read is for exactly one of them.  The
+// faulting thread then waits for its state to change.  write(), futex(2)
+// and gettid(2) are all plain system calls.
+//
+bool
+SigbusWorkers::resolve( char* addr, bool iswrite )
+{
+  int state = PENDING;
+  Request r;
+
+  r.addr = addr;
+  r.tid = (uint32_t)syscall(__NR_gettid);
+  r.iswrite = iswrite;
+  r.state = &state;
+
+  while ( write(m_pipe[1], &r, sizeof(r)) != sizeof(r) ) {
+    if ( errno != EINTR )
+      return false;
+  }
+
+  while ( __atomic_load_n(&state, __ATOMIC_ACQUIRE) == PENDING )
+    syscall(__NR_futex, &state, FUTEX_WAIT_PRIVATE, PENDING, nullptr, nullptr, 0);
+
+  return state == RESOLVED;
+}
+
+void
+SigbusWorkers::ThreadEntry( void )
+{
+  Request r;
+
+  while ( 1 ) {
+    ssize_t n = read(m_pipe[0], &r, sizeof(r));
+
+    if ( n == -1 && errno == EINTR )
+      continue;
+
+    if ( n != sizeof(r) )
+      UMAP_ERROR("read of SIGBUS fault failed: " << (n == -1 ? strerror(errno) : "short read"));
+
+    if ( r.addr == nullptr )
+      break;    // Time to leave
+
+    int state = m_uffd->resolve_fault(r.addr, r.iswrite, r.tid) ? RESOLVED : NOT_OURS;
+
+    //
+    // The faulting thread may return as soon as it sees the new state, so
+    // the wakeup may find its futex gone, which only wakes nobody
+    //
+    __atomic_store_n(r.state, state, __ATOMIC_RELEASE);
+    syscall(__NR_futex, r.state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+}
+
+SigbusWorkers::SigbusWorkers( Uffd* uffd, uint64_t num_workers )
+  :   WorkerPool("SIGBUS Workers", num_workers)
+    , m_uffd(uffd)
+    , m_num_workers(num_workers)
+{
+  if ( pipe2(m_pipe, O_CLOEXEC) < 0 )
+    UMAP_ERROR("SIGBUS pipe failed: " << strerror(errno));
+
+  start_thread_pool();
+}
+
+SigbusWorkers::~SigbusWorkers( void )
+{
+  Request r;
+
+  r.addr = nullptr;
+  r.tid = 0;
+  r.iswrite = false;
+  r.state = nullptr;
+
+  for ( uint64_t i = 0; i < m_num_workers; ++i )
+    (void)write(m_pipe[1], &r, sizeof(r));
+
+  stop_thread_pool();
+
+  close(m_pipe[0]);
+  close(m_pipe[1]);
+}
+} // end of namespace Umap
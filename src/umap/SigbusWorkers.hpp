@@ -0,0 +1,51 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_SigbusWorkers_HPP
+#define _UMAP_SigbusWorkers_HPP
+
+#include <cstdint>
+
+#include "umap/WorkerPool.hpp"
+
+namespace Umap {
+  class Uffd;
+
+  //
+  // With UMAP_SIGBUS, faults are raised as SIGBUS in the faulting thread.
+  // Little may be done in a signal handler, so the handler only passes the
+  // fault to one of these threads over a pipe and sleeps on a futex until
+  // the thread has read the page in and copied it into place.
+  //
+  class SigbusWorkers : public WorkerPool {
+    public:
+      SigbusWorkers( Uffd* uffd, uint64_t num_workers );
+      ~SigbusWorkers( void );
+
+      //
+      // Called from the SIGBUS handler, so only async-signal-safe calls are
+      // made.  Returns false if addr is not in a region.
+      //
+      bool resolve( char* addr, bool iswrite );
+
+    private:
+      enum { PENDING = 0, RESOLVED, NOT_OURS };
+
+      struct Request {
+        char*    addr;        // nullptr when it is time to leave
+        uint32_t tid;         // Of the faulting thread
+        bool     iswrite;
+        int*     state;       // Futex the faulting thread sleeps on
+      };
+
+      Uffd*    m_uffd;
+      uint64_t m_num_workers;
+      int      m_pipe[2];
+
+      void ThreadEntry( void );
+  };
+} // end of namespace Umap
+#endif // _UMAP_SigbusWorkers_HPP
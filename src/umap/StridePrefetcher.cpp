@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <algorithm>            // std::min()
+#include <cstdint>
+
+#include "umap/StridePrefetcher.hpp"
+
+namespace Umap {
+
+const uint64_t StridePrefetcher::INITIAL_WINDOW;
+
+bool StridePrefetcher::fault( uint32_t tid, RegionDescriptor* rd, uint64_t page,
+                              uint64_t max_pages, ReadAhead::Window& w )
+{
+  if ( max_pages < 2 || tid == 0 )
+    return false;
+
+  pthread_mutex_lock(&m_mutex);
+
+  Thread* t = &m_threads[tid % NUM_THREADS];
+
+  if ( t->tid != tid || t->region != rd ) {
+    *t = Thread();
+    t->tid = tid;
+    t->region = rd;
+    t->last = page;
+
+    pthread_mutex_unlock(&m_mutex);
+    return false;
+  }
+
+  int64_t delta = (int64_t)(page - t->last);
+  bool issue = false;
+
+  if ( t->window.size && page == t->window.marker ) {
+    t->window.start += t->window.size * t->window.stride;
+    t->window.size = std::min(t->window.size * 2, max_pages);
+    t->window.marker = t->window.start;
+    issue = true;
+  }
+  else if ( delta != 0 && delta == t->stride ) {
+    if ( ++t->run >= 2 && t->window.size == 0 && t->stride != 1 ) {
+      t->window.start = page + t->stride;
+      t->window.stride = t->stride;
+      t->window.size = std::min(INITIAL_WINDOW, max_pages);
+      t->window.marker = t->window.start + (t->window.size / 2) * t->stride;
+      issue = true;
+    }
+  }
+  else if ( t->window.size && in_window(t, page) ) {
+    //
+    // A page of the window that had not been filled yet, the thread is
+    // still on its stride
+    //
+  }
+  else if ( delta != 0 ) {
+    t->stride = delta;
+    t->run = 1;
+    t->window.size = 0;
+  }
+
+  t->last = page;
+  w = t->window;
+
+  pthread_mutex_unlock(&m_mutex);
+  return issue;
+}
+
+bool StridePrefetcher::in_window( Thread* t, uint64_t page )
+{
+  int64_t distance = (int64_t)(page - t->window.start);
+
+  return    distance % t->window.stride == 0
+         && distance / t->window.stride >= 0
+         && (uint64_t)(distance / t->window.stride) < t->window.size;
+}
+
+StridePrefetcher::StridePrefetcher( void )
+  : m_threads()
+{
+  pthread_mutex_init(&m_mutex, NULL);
+}
+
+StridePrefetcher::~StridePrefetcher( void )
+{
+  pthread_mutex_destroy(&m_mutex);
+}
+} // end of namespace Umap
@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_StridePrefetcher_HPP
+#define _UMAP_StridePrefetcher_HPP
+
+#include <cstdint>
+#include <pthread.h>
+
+#include "umap/ReadAhead.hpp"
+#include "umap/RegionDescriptor.hpp"
+
+namespace Umap {
+  //
+  // Follows the faults of each application thread, as reported with
+  // UFFD_FEATURE_THREAD_ID, to find threads walking a region with a
+  // constant stride.  Faults of different threads are interleaved once they
+  // reach the handlers, so a strided walk is only visible one thread at a
+  // time.
+  //
+  // Once three faults of a thread are the same number of pages apart, pages
+  // further along the stride are read ahead in windows, with a marker page
+  // left out of each window as ReadAhead does.  Forward sequential walks are
+  // left to ReadAhead.
+  //
+  class StridePrefetcher {
+    public:
+      StridePrefetcher( void );
+      ~StridePrefetcher( void );
+
+      //
+      // Called for every fault of thread tid on a page of rd.  Returns true,
+      // with the window to read, when the thread keeps to its stride.
+      // Windows are at most max_pages long.
+      //
+      bool fault( uint32_t tid, RegionDescriptor* rd, uint64_t page,
+                  uint64_t max_pages, ReadAhead::Window& w );
+
+    private:
+      static const int NUM_THREADS = 64;
+      static const uint64_t INITIAL_WINDOW = 4;
+
+      struct Thread {
+        uint32_t tid;               // 0 if the slot has never been used
+        RegionDescriptor* region;
+        uint64_t last;              // Page of the last fault
+        int64_t stride;
+        uint64_t run;               // Faults in a row at this stride
+        ReadAhead::Window window;   // Empty until a stride is found
+      };
+
+      pthread_mutex_t m_mutex;
+      Thread m_threads[NUM_THREADS];
+
+      bool in_window( Thread* t, uint64_t page );
+  };
+} // end of namespace Umap
+#endif // _UMAP_StridePrefetcher_HPP
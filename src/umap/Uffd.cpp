@@ -15,17 +15,83 @@
 #include <fcntl.h>              // O_CLOEXEC
 #include <linux/userfaultfd.h>  // ioctl(UFFDIO_*)
 #include <poll.h>               // poll()
+#include <pthread.h>            // pthread_key_create()
+#include <signal.h>             // sigaction()
 #include <string.h>             // strerror()
+#include <sys/eventfd.h>        // eventfd()
 #include <sys/ioctl.h>          // ioctl()
+#include <sys/mman.h>           // mmap()
 #include <sys/syscall.h>        // syscall()
+#include <ucontext.h>           // ucontext_t
 #include <unistd.h>             // syscall()
 
 #include "umap/config.h"
+#include "umap/FillWorkers.hpp"
 #include "umap/Uffd.hpp"
 #include "umap/RegionDescriptor.hpp"
 #include "umap/RegionManager.hpp"
+#include "umap/SigbusWorkers.hpp"
 #include "umap/util/Macros.hpp"
 
+//
+// Asynchronous write protection and UFFDIO_MOVE came with Linux 6.7 and 6.8
+// and may be missing from the headers even where the running kernel has
+// them.  Whether the kernel has them is found at run time.
+//
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC (1<<15)
+#endif
+
+#ifndef UFFD_FEATURE_MOVE
+#define UFFD_FEATURE_MOVE (1<<16)
+#endif
+
+#ifndef _UFFDIO_MOVE
+#define _UFFDIO_MOVE (0x05)
+#define UFFDIO_MOVE_MODE_DONTWAKE ((__u64)1<<0)
+
+struct uffdio_move {
+  __u64 dst;
+  __u64 src;
+  __u64 len;
+  __u64 mode;
+  __s64 move;
+};
+
+#define UFFDIO_MOVE _IOWR(UFFDIO, _UFFDIO_MOVE, struct uffdio_move)
+#endif
+
+//
+// The PAGEMAP_SCAN ioctl of <linux/fs.h> (Linux 6.7), under names of our
+// own since that header does not mix well with those of the C library
+//
+struct umap_page_region {
+  __u64 start;
+  __u64 end;
+  __u64 categories;
+};
+
+struct umap_pm_scan_arg {
+  __u64 size;
+  __u64 flags;
+  __u64 start;
+  __u64 end;
+  __u64 walk_end;
+  __u64 vec;
+  __u64 vec_len;
+  __u64 max_pages;
+  __u64 category_inverted;
+  __u64 category_mask;
+  __u64 category_anyof_mask;
+  __u64 return_mask;
+};
+
+#define UMAP_PAGEMAP_SCAN         _IOWR('f', 16, struct umap_pm_scan_arg)
+#define UMAP_PM_SCAN_WP_MATCHING  ((__u64)1<<0)
+#define UMAP_PM_SCAN_CHECK_WPASYNC ((__u64)1<<1)
+#define UMAP_PAGE_IS_WRITTEN      ((__u64)1<<1)
+#define UMAP_PAGE_IS_PRESENT      ((__u64)1<<3)
+
 #ifdef CALIPER
 #include "caliper/cali.h"
 cali_id_t pagefault_address_attribute;
@@ -33,6 +99,68 @@ cali_id_t pagefault_address_attribute;
 
 namespace Umap {
 
+Uffd* Uffd::s_sigbus_uffd = nullptr;
+struct sigaction Uffd::s_old_sigbus;
+
+//
+// The SIGBUS workers copy pages in from a buffer of their own, which is
+// unmapped when the thread exits.
+//
+static thread_local char*    t_copyin_buf = nullptr;
+static thread_local uint64_t t_copyin_size = 0;
+static pthread_key_t         copyin_key;
+static pthread_once_t        copyin_key_once = PTHREAD_ONCE_INIT;
+
+static void free_copyin_buf( void* )
+{
+  munmap(t_copyin_buf, t_copyin_size);
+  t_copyin_buf = nullptr;
+  t_copyin_size = 0;
+}
+
+static void create_copyin_key( void )
+{
+  if ( pthread_key_create(&copyin_key, free_copyin_buf) != 0 )
+    UMAP_ERROR("pthread_key_create failed");
+}
+
+static char* copyin_buf( uint64_t size )
+{
+  if ( size > t_copyin_size ) {
+    if ( t_copyin_buf != nullptr )
+      munmap(t_copyin_buf, t_copyin_size);
+
+    t_copyin_buf = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if ( t_copyin_buf == MAP_FAILED )
+      UMAP_ERROR("mmap of " << size << " bytes failed: " << strerror(errno));
+
+    t_copyin_size = size;
+    pthread_setspecific(copyin_key, t_copyin_buf);
+  }
+
+  return t_copyin_buf;
+}
+
+//
+// SIGBUS does not say whether the fault was a write.  Where the page fault
+// error code is not there to tell, every fault on a writable region is taken
+// to be one, so that a page only read may be written back.
+//
+static bool fault_is_write( void*
+#if defined(__x86_64__)
+                            context
+#endif
+                          )
+{
+#if defined(__x86_64__)
+  return (((ucontext_t*)context)->uc_mcontext.gregs[REG_ERR] & 0x2) != 0;
+#else
+  return true;
+#endif
+}
+
 struct less_than_key {
   inline bool operator() ( const uffd_msg& lhs, const uffd_msg& rhs ) {
     if (lhs.arg.pagefault.address == rhs.arg.pagefault.address)
@@ -43,30 +171,27 @@ struct less_than_key {
 };
 
 void
-Uffd::uffd_handler( void )
+Uffd::uffd_handler( Handler& h )
 {
-  struct pollfd pollfd[3] = {
-      { .fd = m_uffd_fd, .events = POLLIN }
-    , { .fd = m_pipe[0], .events = POLLIN }
-    , { .fd = m_pipe[1], .events = POLLIN }
-  };
+  struct pollfd pollfd[4] = {};
+
+  pollfd[0].fd = h.fd;
+  pollfd[1].fd = m_pipe[0];
+  pollfd[2].fd = m_pipe[1];
+  pollfd[3].fd = h.avail_fd;
+  for ( int i = 0; i < 4; ++i )
+    pollfd[i].events = POLLIN;
 
   //
-  // For the Uffd worker thread, we use our work queue as a sentinel for
-  // when it is time to leave (since this particular thread gets its work
-  // from the m_uffd_fd kernel module.
+  // For the Uffd worker threads, we use our work queue as a sentinel for
+  // when it is time to leave (since these threads get their work from
+  // their userfaultfds).
   //
   while ( wq_is_empty() ) {
-    int pollres = poll(&pollfd[0], 3, -1);
-
-    switch (pollres) {
-      case 1:
-        break;
-      case -1:
-        UMAP_ERROR("poll failed: " << strerror(errno));
-      default:
-        UMAP_ERROR("poll: unexpected result: " << pollres);
-    }
+    int pollres = poll(&pollfd[0], 4, -1);
+
+    if (pollres == -1)
+      UMAP_ERROR("poll failed: " << strerror(errno));
 
     if (pollfd[1].revents & POLLIN || pollfd[2].revents & POLLIN)
       break;
@@ -74,10 +199,17 @@ Uffd::uffd_handler( void )
     if (pollfd[0].revents & POLLERR)
       UMAP_ERROR("POLLERR: ");
 
+    if (pollfd[3].revents & POLLIN) {
+      eventfd_t count;
+
+      eventfd_read(h.avail_fd, &count);
+      process_deferred(h);
+    }
+
     if ( !(pollfd[0].revents & POLLIN) )
       continue;
 
-    int readres = read(m_uffd_fd, &m_events[0], m_max_fault_events * sizeof(struct uffd_msg));
+    ssize_t readres = read(h.fd, &h.events[0], m_max_fault_events * sizeof(struct uffd_msg));
 
     if (readres == -1) {
       if (errno == EAGAIN)
@@ -88,7 +220,7 @@ Uffd::uffd_handler( void )
 
     assert("Invalid read result returned" && (readres % sizeof(struct uffd_msg) == 0));
 
-    int msgs = readres / sizeof(struct uffd_msg);
+    uint64_t msgs = readres / sizeof(struct uffd_msg);
 
     assert("invalid message size" && msgs >= 1 && msgs <= m_max_fault_events);
 
@@ -99,40 +231,192 @@ Uffd::uffd_handler( void )
     // events are then sorted in page base address / operation type order and
     // are processed only once while duplicates are skipped.
     //
-    for (int i = 0; i < msgs; ++i)
-      m_events[i].arg.pagefault.address &= ~(m_page_size-1);
+    for (uint64_t i = 0; i < msgs; ++i)
+      h.events[i].arg.pagefault.address &= ~(m_page_size-1);
 
-    std::sort(&m_events[0], &m_events[msgs], less_than_key());
+    std::sort(&h.events[0], &h.events[msgs], less_than_key());
+
+#ifdef UFFD_FEATURE_THREAD_ID
+    //
+    // Each thread has at most one fault outstanding, so every event, even
+    // one for the same page as another, is a step along the stride of its
+    // own thread.  Strides are followed before any of the faults are let go,
+    // since a thread may unmap the region as soon as its fault is resolved.
+    //
+    if ( m_thread_ids ) {
+      for (uint64_t i = 0; i < msgs; ++i)
+        prefetch_stride(  h.events[i].arg.pagefault.feat.ptid
+                        , (char*)(h.events[i].arg.pagefault.address));
+    }
+#endif
 
     char* last_addr = nullptr;
-    for (int i = 0; i < msgs; ++i) {
-      if ((char*)(m_events[i].arg.pagefault.address) == last_addr)
-        continue;
+    for (uint64_t i = 0; i < msgs; ++i) {
+      char* addr = (char*)(h.events[i].arg.pagefault.address);
 
-      last_addr = (char*)(m_events[i].arg.pagefault.address);
+      if (addr != last_addr) {
+        last_addr = addr;
 
 #ifndef UMAP_RO_MODE
-      bool iswrite = (m_events[i].arg.pagefault.flags & (UFFD_PAGEFAULT_FLAG_WP | UFFD_PAGEFAULT_FLAG_WRITE) != 0);
+        bool iswrite = (h.events[i].arg.pagefault.flags & (UFFD_PAGEFAULT_FLAG_WP | UFFD_PAGEFAULT_FLAG_WRITE) != 0);
 #else
-      bool iswrite = false;
+        bool iswrite = false;
 #endif
 
-      //
-      // TODO: Since the addresses are sorted, we could optimize the
-      // search to continue from where it last found something.
-      //
-      process_page(iswrite, last_addr);
+        //
+        // TODO: Since the addresses are sorted, we could optimize the
+        // search to continue from where it last found something.
+        //
+        Fault f;
+
+        f.addr = last_addr;
+        f.iswrite = iswrite;
+        f.throttled = false;
 
-      /* providing page fault information to Caliper Toolkit */
+        if ( ! handle_fault(f) )
+          h.deferred.push_back(f);
+
+        /* providing page fault information to Caliper Toolkit */
 #ifdef CALIPER
-      cali_variant_t v_addr = cali_make_variant(CALI_TYPE_ADDR, &last_addr, sizeof(char*));
-      cali_push_snapshot(CALI_SCOPE_PROCESS, 1, &pagefault_address_attribute, &v_addr);
+        cali_variant_t v_addr = cali_make_variant(CALI_TYPE_ADDR, &last_addr, sizeof(char*));
+        cali_push_snapshot(CALI_SCOPE_PROCESS, 1, &pagefault_address_attribute, &v_addr);
 #endif
+      }
+
     }
+
+    if ( ! h.deferred.empty() )
+      process_deferred(h);
   }
   UMAP_LOG(Debug, "Good bye");
 }
 
+//
+// Returns false if the fault has to wait for a page descriptor, or for
+// dirty pages to be written back
+//
+bool
+Uffd::handle_fault( Fault& f )
+{
+  auto rd = m_rm.containing_region(f.addr);
+
+  if ( rd == nullptr )
+    return true;
+
+  return m_buffer->process_page_event(f.addr, f.iswrite, rd, false, nullptr, &f.throttled);
+}
+
+//
+// Retries the faults held back by h in the order they came in, until one
+// still finds no page descriptor.  The handler then asks to be told when
+// one is made available, and looks again in case that happened before it
+// asked.
+//
+void
+Uffd::process_deferred( Handler& h )
+{
+  while ( ! h.deferred.empty() ) {
+    uint64_t generation = m_buffer->page_descriptor_generation();
+    Fault& f = h.deferred.front();
+
+    if ( handle_fault(f) ) {
+      h.deferred.pop_front();
+      continue;
+    }
+
+    if ( ! h.deferring ) {
+      h.deferring = true;
+      ++m_num_deferring;
+    }
+
+    if ( m_buffer->page_descriptor_generation() == generation )
+      return;
+  }
+
+  if ( h.deferring ) {
+    h.deferring = false;
+    --m_num_deferring;
+  }
+}
+
+//
+// Resolves a fault of thread tid on addr for the SIGBUS handler, waiting
+// for whatever it needs just as a handler would, then filling the page
+// itself rather than through the Fill workers.  Returns false if addr is
+// not in a region.
+//
+bool
+Uffd::resolve_fault( char* addr, bool iswrite, uint32_t tid )
+{
+  char* page = (char*)((uint64_t)addr & ~(m_page_size - 1));
+  auto rd = m_rm.containing_region(page);
+  WorkItem work;
+
+  if ( rd == nullptr )
+    return false;
+
+  prefetch_stride(tid, page);
+
+  //
+  // Nothing may be written to a read-only region, which is not registered
+  // for write protection either, whatever fault_is_write() made of it
+  //
+  m_buffer->process_page_event(page, iswrite && rd->writable(), rd, true, &work);
+
+  if ( work.page_desc != nullptr )
+    m_rm.get_fill_workers_h()->fill(work, copyin_buf(work.num_pages * m_page_size), m_page_size);
+
+  return true;
+}
+
+//
+// Only async-signal-safe calls may be made here, so the fault is handed to
+// the SIGBUS workers
+//
+void
+Uffd::sigbus_handler( int sig, siginfo_t* info, void* context )
+{
+  int saved_errno = errno;
+  Uffd* uffd = s_sigbus_uffd;
+
+  if (   info->si_code == BUS_ADRERR && uffd != nullptr
+      && uffd->m_sigbus_workers->resolve((char*)info->si_addr, fault_is_write(context)) ) {
+    errno = saved_errno;
+    return;
+  }
+
+  //
+  // Not ours, so it goes to whoever had SIGBUS before
+  //
+  if ( s_old_sigbus.sa_flags & SA_SIGINFO ) {
+    s_old_sigbus.sa_sigaction(sig, info, context);
+  }
+  else if ( s_old_sigbus.sa_handler == SIG_DFL ) {
+    signal(SIGBUS, SIG_DFL);
+    raise(SIGBUS);
+  }
+  else if ( s_old_sigbus.sa_handler != SIG_IGN ) {
+    s_old_sigbus.sa_handler(sig);
+  }
+
+  errno = saved_errno;
+}
+
+//
+// Called by the Buffer whenever page descriptors are released or added
+//
+void
+Uffd::page_descriptors_available( void )
+{
+  if ( m_num_deferring == 0 )
+    return;
+
+  for ( auto& h : m_handlers ) {
+    if ( h.deferring )
+      eventfd_write(h.avail_fd, 1);
+  }
+}
+
 void
 Uffd::process_page( bool iswrite, char* addr )
 {
@@ -142,31 +426,82 @@ Uffd::process_page( bool iswrite, char* addr )
     m_buffer->process_page_event(addr, iswrite, rd);
 }
 
+void
+Uffd::prefetch_stride( uint32_t tid, char* addr )
+{
+  auto rd = m_rm.containing_region(addr);
+  ReadAhead::Window w;
+
+  if (    rd != nullptr
+       && m_strides.fault(tid, rd, rd->page_index(addr), m_buffer->max_read_ahead(), w) )
+    m_buffer->read_ahead(rd, w);
+}
+
 void
 Uffd::ThreadEntry()
 {
-  uffd_handler();
+  uffd_handler(m_handlers[m_next_thread++]);
 }
 
 Uffd::Uffd( void )
-  :   WorkerPool("Uffd Manager", 1)
+  :   WorkerPool("Uffd Manager", RegionManager::getInstance().get_num_uffd_threads())
     , m_rm(RegionManager::getInstance())
     , m_max_fault_events(m_rm.get_max_fault_events())
     , m_page_size(m_rm.get_umap_page_size())
     , m_buffer(m_rm.get_buffer_h())
+    , m_handlers(m_rm.get_num_uffd_threads())
+    , m_next_thread(0)
+    , m_num_deferring(0)
+    , m_next_region(0)
+    , m_features(probe_uffd_features())
+    , m_thread_ids(false)
+    , m_wp_async(false)
+    , m_pagemap(-1)
+    , m_sigbus(false)
+    , m_sigbus_workers(nullptr)
 {
   UMAP_LOG(Debug, "\n maximum fault events: " << m_max_fault_events
-                  << "\n            page size: " << m_page_size);
+                  << "\n            page size: " << m_page_size
+                  << "\n      handler threads: " << m_handlers.size());
 
-  if ((m_uffd_fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK)) < 0)
-    UMAP_ERROR("userfaultfd syscall not available in this kernel: "
-        << strerror(errno));
+  if ( m_rm.get_wp_async() )
+    m_wp_async = probe_wp_async();
+
+  if ( m_rm.get_sigbus() )
+    m_sigbus = probe_sigbus();
+
+  for ( auto& h : m_handlers ) {
+    if ((h.fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK)) < 0)
+      UMAP_ERROR("userfaultfd syscall not available in this kernel: "
+          << strerror(errno));
+
+    check_uffd_compatibility(h.fd);
+    h.events.resize(m_max_fault_events);
+
+    if ((h.avail_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+      UMAP_ERROR("eventfd failed: " << strerror(errno));
+
+    h.deferring = false;
+  }
 
   if (pipe2(m_pipe, 0) < 0)
     UMAP_ERROR("userfaultfd pipe failed: " << strerror(errno));
 
-  check_uffd_compatibility();
-  m_events.resize(m_max_fault_events);
+  if ( m_sigbus ) {
+    struct sigaction sa;
+
+    pthread_once(&copyin_key_once, create_copyin_key);
+    m_sigbus_workers = new SigbusWorkers(this, m_rm.get_num_fillers());
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = sigbus_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    s_sigbus_uffd = this;
+    if (sigaction(SIGBUS, &sa, &s_old_sigbus) == -1)
+      UMAP_ERROR("sigaction(SIGBUS) failed: " << strerror(errno));
+  }
 
   start_thread_pool();
 
@@ -188,76 +523,115 @@ Uffd::~Uffd()
   write(m_pipe[1], bye, 3);
 
   stop_thread_pool();
+
+  if ( m_sigbus ) {
+    sigaction(SIGBUS, &s_old_sigbus, nullptr);
+    s_sigbus_uffd = nullptr;
+    delete m_sigbus_workers;
+  }
+
+  for ( auto& h : m_handlers ) {
+    close(h.fd);
+    close(h.avail_fd);
+  }
+
+  if ( m_pagemap != -1 )
+    close(m_pagemap);
 }
 
 void
 Uffd::enable_write_protect(
-          void*
+          RegionDescriptor*
+#ifndef UMAP_RO_MODE
+          rd
+#endif
+        , void*
 #ifndef UMAP_RO_MODE
           page_address
+#endif
+        , uint64_t
+#ifndef UMAP_RO_MODE
+          num_pages
 #endif
       )
 {
 #ifndef UMAP_RO_MODE
-  struct uffdio_writeprotect wp = {
-      .range = { .start = (uint64_t)page_address, .len = m_page_size }
-    , .mode = UFFDIO_WRITEPROTECT_MODE_WP
-  };
+  struct uffdio_writeprotect wp = {};
+
+  wp.range.start = (uint64_t)page_address;
+  wp.range.len = num_pages * m_page_size;
+  wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
 
-  if (ioctl(m_uffd_fd, UFFDIO_WRITEPROTECT, &wp) == -1)
+  if (ioctl(fd_of(rd, page_address), UFFDIO_WRITEPROTECT, &wp) == -1)
     UMAP_ERROR("ioctl(UFFDIO_WRITEPROTECT): " << strerror(errno));
 #endif // UMAP_RO_MODE
 }
 
 void
 Uffd::disable_write_protect(
-  void*
+  RegionDescriptor*
+#ifndef UMAP_RO_MODE
+  rd
+#endif
+, void*
 #ifndef UMAP_RO_MODE
   page_address
 #endif
+, bool
+#ifndef UMAP_RO_MODE
+  wake
+#endif
 )
 {
 #ifndef UMAP_RO_MODE
-  struct uffdio_writeprotect wp = {
-      .range = { .start = (uint64_t)page_address, .len = m_page_size }
-    , .mode = 0
-  };
+  struct uffdio_writeprotect wp = {};
+
+  wp.range.start = (uint64_t)page_address;
+  wp.range.len = m_page_size;
+  wp.mode = wake ? 0 : UFFDIO_WRITEPROTECT_MODE_DONTWAKE;
 
-  if (ioctl(m_uffd_fd, UFFDIO_WRITEPROTECT, &wp) == -1)
+  if (ioctl(fd_of(rd, page_address), UFFDIO_WRITEPROTECT, &wp) == -1)
     UMAP_ERROR("ioctl(UFFDIO_WRITEPROTECT): " << strerror(errno));
 #endif // UMAP_RO_MODE
 }
 
 void
-Uffd::copy_in_page(char* data, void* page_address)
+Uffd::copy_in_page(RegionDescriptor* rd, char* data, void* page_address)
 {
-  struct uffdio_copy copy = {
-      .dst = (uint64_t)page_address
-    , .src = (uint64_t)data
-    , .len = m_page_size
-    , .mode = 0
-  };
-
-  if (ioctl(m_uffd_fd, UFFDIO_COPY, &copy) == -1)
+  struct uffdio_copy copy = {};
+
+  copy.dst = (uint64_t)page_address;
+  copy.src = (uint64_t)data;
+  copy.len = m_page_size;
+
+  if (ioctl(fd_of(rd, page_address), UFFDIO_COPY, &copy) == -1)
     UMAP_ERROR("UFFDIO_COPY failed: " << strerror(errno));
 }
 
+//
+// A page filled without waking its waiters is only resolved for threads
+// that fault on it once it is in place.  Those that faulted before are left
+// for the handlers to wake once their faults have been processed.
+//
 void
-Uffd::copy_in_page_and_write_protect(char* data, void* page_address)
+Uffd::copy_in_page_and_write_protect(RegionDescriptor* rd, char* data, void* page_address, bool wake)
 {
   UMAP_LOG(Debug, "(page_address = " << page_address << ")");
-  struct uffdio_copy copy = {
-      .dst = (uint64_t)page_address
-    , .src = (uint64_t)data
-    , .len = m_page_size
+  struct uffdio_copy copy = {};
+
+  copy.dst = (uint64_t)page_address;
+  copy.src = (uint64_t)data;
+  copy.len = m_page_size;
+
 #ifndef UMAP_RO_MODE
-    , .mode = UFFDIO_COPY_MODE_WP
-#else
-    , .mode = 0
+  if ( rd->writable() )
+    copy.mode |= UFFDIO_COPY_MODE_WP;
 #endif
-  };
 
-  if (ioctl(m_uffd_fd, UFFDIO_COPY, &copy) == -1) {
+  if ( ! wake )
+    copy.mode |= UFFDIO_COPY_MODE_DONTWAKE;
+
+  if (ioctl(fd_of(rd, page_address), UFFDIO_COPY, &copy) == -1) {
     UMAP_ERROR("UFFDIO_COPY failed @ " 
         << page_address << " : "
         << strerror(errno) << std::endl
@@ -265,36 +639,223 @@ Uffd::copy_in_page_and_write_protect(char* data, void* page_address)
   }
 }
 
+//
+// Fills a run of pages with a single copy that wakes no thread, so that
+// the caller can wake the threads that faulted on them once all of its
+// work on the pages is done, with one wake_up() over the run or one page
+// at a time
+//
 void
-Uffd::register_region( RegionDescriptor* rd )
+Uffd::copy_in_pages_and_write_protect(RegionDescriptor* rd, char* data, void* page_address, uint64_t num_pages)
 {
-  struct uffdio_register uffdio_register = {
-      .range = {  .start = (__u64)(rd->start()), .len = rd->size() }
+  uint64_t len = num_pages * m_page_size;
+  uint64_t done = 0;
+
+  while ( done < len ) {
+    struct uffdio_copy copy = {};
+
+    copy.dst = (uint64_t)page_address + done;
+    copy.src = (uint64_t)data + done;
+    copy.len = len - done;
+    copy.mode = UFFDIO_COPY_MODE_DONTWAKE;
+
 #ifndef UMAP_RO_MODE
-    , .mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP
-#else
-    , .mode = UFFDIO_REGISTER_MODE_MISSING
+    if ( rd->writable() )
+      copy.mode |= UFFDIO_COPY_MODE_WP;
 #endif
-  };
 
-  UMAP_LOG(Debug,
-    "Registering " << (uffdio_register.range.len / m_page_size)
-    << " pages from: " << (void*)(uffdio_register.range.start)
-    << " - " << (void*)(uffdio_register.range.start +
-                              (uffdio_register.range.len-1)));
+    //
+    // A large copy may be cut short, with what was copied so far reported,
+    // when the layout of the address space changes underneath it
+    //
+    if (ioctl(fd_of(rd, page_address), UFFDIO_COPY, &copy) == -1 && errno != EAGAIN) {
+      UMAP_ERROR("UFFDIO_COPY failed @ "
+          << page_address << " for " << num_pages << " pages: "
+          << strerror(errno) << std::endl
+      );
+    }
 
-  if (ioctl(m_uffd_fd, UFFDIO_REGISTER, &uffdio_register) == -1) {
-    UMAP_ERROR("ioctl(UFFDIO_REGISTER) failed: " << strerror(errno)
-        << "Number of regions is: " << m_rm.get_num_active_regions()
-    );
+    if ( copy.copy > 0 )
+      done += copy.copy;
+  }
+}
+
+void
+Uffd::wake_up( RegionDescriptor* rd, void* page_address, uint64_t num_pages )
+{
+  struct uffdio_range range = {};
+
+  range.start = (uint64_t)page_address;
+  range.len = num_pages * m_page_size;
+
+  if (ioctl(fd_of(rd, page_address), UFFDIO_WAKE, &range) == -1)
+    UMAP_ERROR("ioctl(UFFDIO_WAKE): " << strerror(errno));
+}
+
+//
+// Appends the pages of rd written since they were last write protected.
+// With protect, the pages found are write protected again by the same scan,
+// so that a write after the scan is found by the next one.
+//
+void
+Uffd::scan_written_pages( RegionDescriptor* rd, bool protect, std::vector<char*>& pages )
+{
+  const uint64_t max_runs = 256;
+  struct umap_page_region runs[max_runs];
+  uint64_t start = (uint64_t)rd->start();
+
+  while ( start < (uint64_t)rd->end() ) {
+    //
+    // Pages never filled, or given back with madvise(), are reported as
+    // written too, so only those present are asked for
+    //
+    struct umap_pm_scan_arg arg = {};
+
+    arg.size = sizeof(arg);
+    arg.flags = protect ? (UMAP_PM_SCAN_WP_MATCHING | UMAP_PM_SCAN_CHECK_WPASYNC) : 0;
+    arg.start = start;
+    arg.end = (uint64_t)rd->end();
+    arg.vec = (uint64_t)runs;
+    arg.vec_len = max_runs;
+    arg.category_mask = UMAP_PAGE_IS_WRITTEN | UMAP_PAGE_IS_PRESENT;
+    arg.return_mask = UMAP_PAGE_IS_WRITTEN | UMAP_PAGE_IS_PRESENT;
+
+    long n = ioctl(m_pagemap, UMAP_PAGEMAP_SCAN, &arg);
+
+    if ( n == -1 )
+      UMAP_ERROR("ioctl(PAGEMAP_SCAN) failed: " << strerror(errno));
+
+    //
+    // Runs are in system pages, which may be smaller than ours
+    //
+    for ( long i = 0; i < n; ++i ) {
+      char* page = rd->start() + (runs[i].start - (uint64_t)rd->start()) / m_page_size * m_page_size;
+
+      for ( ; (uint64_t)page < runs[i].end; page += m_page_size ) {
+        if ( pages.empty() || pages.back() != page )
+          pages.push_back(page);
+      }
+    }
+
+    start = arg.walk_end;
+  }
+}
+
+//
+// A page can only be moved to memory registered with the userfaultfd that
+// handles it, so there is a staging page for each handler
+//
+char*
+Uffd::alloc_staging_pages( void )
+{
+  uint64_t len = m_handlers.size() * m_page_size;
+  char* staging = (char*)mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if ( staging == MAP_FAILED )
+    UMAP_ERROR("mmap of staging pages failed: " << strerror(errno));
+
+  for ( uint64_t h = 0; h < m_handlers.size(); ++h ) {
+    struct uffdio_register uffdio_register = {};
+
+    uffdio_register.range.start = (__u64)(staging + h * m_page_size);
+    uffdio_register.range.len = m_page_size;
+    uffdio_register.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+    if (ioctl(m_handlers[h].fd, UFFDIO_REGISTER, &uffdio_register) == -1)
+      UMAP_ERROR("ioctl(UFFDIO_REGISTER) of staging page failed: " << strerror(errno));
   }
-  
-  if( !(uffdio_register.ioctls & (1 << _UFFDIO_COPY))
+
+  return staging;
+}
+
+void
+Uffd::free_staging_pages( char* staging )
+{
+  munmap(staging, m_handlers.size() * m_page_size);
+}
+
+//
+// Takes a page out of its region, so that any access made to it from now on
+// faults, and returns where its contents went.  Returns nullptr, with errno
+// set, if nothing was moved.  ENOENT means the page was not there.
+//
+char*
+Uffd::move_out_page( RegionDescriptor* rd, void* page_address, char* staging )
+{
+  char* dst = staging + (rd->uffd_handler_of((char*)page_address) % m_handlers.size()) * m_page_size;
+  uint64_t done = 0;
+
+  while ( done < m_page_size ) {
+    struct uffdio_move move = {};
+
+    move.dst = (uint64_t)dst + done;
+    move.src = (uint64_t)page_address + done;
+    move.len = m_page_size - done;
+    move.mode = UFFDIO_MOVE_MODE_DONTWAKE;
+
+    if (ioctl(fd_of(rd, page_address), UFFDIO_MOVE, &move) == -1 && errno != EAGAIN) {
+      if ( done == 0 && move.move <= 0 )
+        return nullptr;
+
+      UMAP_ERROR("UFFDIO_MOVE failed @ " << page_address
+          << " after " << (done + std::max(move.move, (__s64)0)) << " bytes: " << strerror(errno));
+    }
+
+    if ( move.move > 0 )
+      done += move.move;
+  }
+
+  return dst;
+}
+
+void
+Uffd::register_region( RegionDescriptor* rd )
+{
+  //
+  // The region is split into a stripe of whole pages for each handler.
+  // Each region starts with the next handler in turn, so that regions too
+  // small to be split are spread over the handlers as well.
+  //
+  uint64_t num_handlers = m_handlers.size();
+  uint64_t stripe_pages = (rd->num_pages() + num_handlers - 1) / num_handlers;
+
+  rd->set_uffd_stripes(m_next_region++ % num_handlers, stripe_pages * m_page_size);
+
+  for ( uint64_t off = 0; off < rd->size(); off += rd->uffd_stripe_size() ) {
+    char* start = rd->start() + off;
+
+    struct uffdio_register uffdio_register = {};
+
+    uffdio_register.range.start = (__u64)start;
+    uffdio_register.range.len = std::min(rd->uffd_stripe_size(), rd->size() - off);
+    uffdio_register.mode = UFFDIO_REGISTER_MODE_MISSING;
+
+#ifndef UMAP_RO_MODE
+    if ( rd->writable() )
+      uffdio_register.mode |= UFFDIO_REGISTER_MODE_WP;
+#endif
+
+    UMAP_LOG(Debug,
+      "Registering " << (uffdio_register.range.len / m_page_size)
+      << " pages from: " << (void*)(uffdio_register.range.start)
+      << " - " << (void*)(uffdio_register.range.start +
+                                (uffdio_register.range.len-1))
+      << " with handler " << rd->uffd_handler_of(start) % num_handlers);
+
+    if (ioctl(fd_of(rd, start), UFFDIO_REGISTER, &uffdio_register) == -1) {
+      UMAP_ERROR("ioctl(UFFDIO_REGISTER) failed: " << strerror(errno)
+          << "Number of regions is: " << m_rm.get_num_active_regions()
+      );
+    }
+
+    if( !(uffdio_register.ioctls & (1 << _UFFDIO_COPY))
 #ifdef UFFDIO_WRITEPROTECT
-      || !(uffdio_register.ioctls & (1 << _UFFDIO_WRITEPROTECT))
+        || ( rd->writable() && !(uffdio_register.ioctls & (1 << _UFFDIO_WRITEPROTECT)) )
 #endif
-    )
-    UMAP_ERROR("unexpected userfaultfd ioctl set: " << uffdio_register.ioctls);
+      )
+      UMAP_ERROR("unexpected userfaultfd ioctl set: " << uffdio_register.ioctls);
+  }
 }
 
 void
@@ -306,41 +867,145 @@ Uffd::unregister_region( RegionDescriptor* rd )
   //
   m_buffer->evict_region(rd);
 
-  struct uffdio_register uffdio_register = {
-      .range = { .start = (__u64)(rd->start()), .len = rd->size() }
-    , .mode = 0
-  };
+  for ( uint64_t off = 0; off < rd->size(); off += rd->uffd_stripe_size() ) {
+    char* start = rd->start() + off;
+
+    struct uffdio_register uffdio_register = {};
 
-  UMAP_LOG(Debug,
-    "Unregistering " << (uffdio_register.range.len / m_page_size)
-    << " pages from: " << (void*)(uffdio_register.range.start)
-    << " - " << (void*)(uffdio_register.range.start +
-                              (uffdio_register.range.len-1)));
+    uffdio_register.range.start = (__u64)start;
+    uffdio_register.range.len = std::min(rd->uffd_stripe_size(), rd->size() - off);
 
-  if (ioctl(m_uffd_fd, UFFDIO_UNREGISTER, &uffdio_register.range))
-    UMAP_ERROR("ioctl(UFFDIO_UNREGISTER) failed: " << strerror(errno));
+    UMAP_LOG(Debug,
+      "Unregistering " << (uffdio_register.range.len / m_page_size)
+      << " pages from: " << (void*)(uffdio_register.range.start)
+      << " - " << (void*)(uffdio_register.range.start +
+                                (uffdio_register.range.len-1)));
+
+    if (ioctl(fd_of(rd, start), UFFDIO_UNREGISTER, &uffdio_register.range))
+      UMAP_ERROR("ioctl(UFFDIO_UNREGISTER) failed: " << strerror(errno));
+  }
+}
+
+//
+// UFFDIO_API may only be done once on a userfaultfd and fails if asked for
+// a feature the kernel does not have, so the features are found on a
+// userfaultfd of their own before the handlers ask for the ones they use.
+//
+uint64_t
+Uffd::probe_uffd_features( void )
+{
+  struct uffdio_api uffdio_api = {};
+  int fd;
+
+  uffdio_api.api = UFFD_API;
+
+  if ((fd = syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK)) < 0)
+    UMAP_ERROR("userfaultfd syscall not available in this kernel: "
+        << strerror(errno));
+
+  if (ioctl(fd, UFFDIO_API, &uffdio_api) == -1)
+    UMAP_ERROR("ioctl(UFFDIO_API) Failed: " << strerror(errno));
+
+  close(fd);
+  return uffdio_api.features;
 }
 
 void
-Uffd::check_uffd_compatibility( void )
+Uffd::check_uffd_compatibility( int fd )
+{
+  struct uffdio_api uffdio_api = {};
+
+  uffdio_api.api = UFFD_API;
+#ifndef UMAP_RO_MODE
+  uffdio_api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+#endif
+
+#ifndef UMAP_RO_MODE
+  if ( !(m_features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) )
+    UMAP_ERROR("UFFD Compatibilty Check - unsupported userfaultfd WP");
+#endif
+
+#ifdef UFFD_FEATURE_THREAD_ID
+  if ( m_features & UFFD_FEATURE_THREAD_ID ) {
+    uffdio_api.features |= UFFD_FEATURE_THREAD_ID;
+    m_thread_ids = true;
+  }
+#endif
+
+  if ( m_wp_async )
+    uffdio_api.features |= UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_MOVE;
+
+#ifdef UFFD_FEATURE_SIGBUS
+  if ( m_sigbus )
+    uffdio_api.features |= UFFD_FEATURE_SIGBUS;
+#endif
+
+  if (ioctl(fd, UFFDIO_API, &uffdio_api) == -1)
+    UMAP_ERROR("ioctl(UFFDIO_API) Failed: " << strerror(errno));
+}
+
+//
+// Asynchronous write protection needs the kernel to let writes through,
+// to move pages out of a region for eviction, and to scan the page table
+// for the pages written.  Without any of these, writes fault as before.
+//
+bool
+Uffd::probe_wp_async( void )
 {
-  struct uffdio_api uffdio_api = {
-      .api = UFFD_API
 #ifdef UMAP_RO_MODE
-    , .features = 0
+  return false;
 #else
-    , .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP
-#endif
+  const uint64_t needed = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_MOVE;
 
-    , .ioctls = 0
-  };
+  if ( (m_features & needed) != needed ) {
+    UMAP_LOG(Info, "UMAP_WP_ASYNC: asynchronous write protection or UFFDIO_MOVE"
+                   " not supported by this kernel, writes will fault");
+    return false;
+  }
 
-if (ioctl(m_uffd_fd, UFFDIO_API, &uffdio_api) == -1)
-  UMAP_ERROR("ioctl(UFFDIO_API) Failed: " << strerror(errno));
+  if ( (m_pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC)) == -1 ) {
+    UMAP_LOG(Info, "UMAP_WP_ASYNC: /proc/self/pagemap: " << strerror(errno)
+                   << ", writes will fault");
+    return false;
+  }
 
-#ifndef UMAP_RO_MODE
-if ( !(uffdio_api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP) )
-  UMAP_ERROR("UFFD Compatibilty Check - unsupported userfaultfd WP");
+  //
+  // Any page will do to see if the scan is there
+  //
+  uint64_t psize = m_rm.get_system_page_size();
+  uint64_t page = (uint64_t)&m_features & ~(psize - 1);
+  struct umap_page_region run;
+  struct umap_pm_scan_arg arg = {};
+
+  arg.size = sizeof(arg);
+  arg.start = page;
+  arg.end = page + psize;
+  arg.vec = (uint64_t)&run;
+  arg.vec_len = 1;
+  arg.return_mask = UMAP_PAGE_IS_PRESENT;
+
+  if ( ioctl(m_pagemap, UMAP_PAGEMAP_SCAN, &arg) == -1 ) {
+    UMAP_LOG(Info, "UMAP_WP_ASYNC: ioctl(PAGEMAP_SCAN): " << strerror(errno)
+                   << ", writes will fault");
+    close(m_pagemap);
+    m_pagemap = -1;
+    return false;
+  }
+
+  return true;
+#endif
+}
+
+bool
+Uffd::probe_sigbus( void )
+{
+#ifdef UFFD_FEATURE_SIGBUS
+  if ( m_features & UFFD_FEATURE_SIGBUS )
+    return true;
 #endif
+
+  UMAP_LOG(Info, "UMAP_SIGBUS: UFFD_FEATURE_SIGBUS not supported,"
+                 " faults are handed to the handlers");
+  return false;
 }
 } // end of namespace Umap
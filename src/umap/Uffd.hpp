@@ -8,8 +8,10 @@
 #define _UMAP_Uffd_HPP
 
 #include <algorithm>            // sort()
+#include <atomic>
 #include <cassert>              // assert()
 #include <cstdint>              // uint64_t
+#include <deque>
 #include <iomanip>
 #include <iostream>
 #include <vector>               // We all have lists to manage
@@ -18,6 +20,7 @@
 #include <fcntl.h>              // O_CLOEXEC
 #include <linux/userfaultfd.h>  // ioctl(UFFDIO_*)
 #include <poll.h>               // poll()
+#include <signal.h>             // sigaction()
 #include <string.h>             // strerror()
 #include <sys/ioctl.h>          // ioctl()
 #include <sys/syscall.h>        // syscall()
@@ -33,10 +36,12 @@
 
 #include "umap/RegionDescriptor.hpp"
 #include "umap/RegionManager.hpp"
+#include "umap/StridePrefetcher.hpp"
 #include "umap/WorkerPool.hpp"
 
 namespace Umap {
   class RegionManager;
+  class SigbusWorkers;
 
   class PageEvent {
     public:
@@ -52,23 +57,88 @@ namespace Umap {
       void register_region( RegionDescriptor* region );
       void unregister_region( RegionDescriptor* region );
 
-      void  enable_write_protect( void* );
-      void disable_write_protect( void* );
-      void copy_in_page(char* data, void* page_address);
-      void copy_in_page_and_write_protect(char* data, void* page_address);
+      void  enable_write_protect( RegionDescriptor* rd, void* page_address, uint64_t num_pages = 1 );
+      void disable_write_protect( RegionDescriptor* rd, void* page_address, bool wake = true );
+      void copy_in_page( RegionDescriptor* rd, char* data, void* page_address );
+      void copy_in_page_and_write_protect( RegionDescriptor* rd, char* data, void* page_address, bool wake = true );
+      void copy_in_pages_and_write_protect( RegionDescriptor* rd, char* data, void* page_address, uint64_t num_pages );
+      void wake_up( RegionDescriptor* rd, void* page_address, uint64_t num_pages = 1 );
+      void page_descriptors_available( void );
+      bool resolve_fault( char* addr, bool iswrite, uint32_t tid );
+
+      //
+      // With asynchronous write protection (UMAP_WP_ASYNC), writes to
+      // protected pages are let through by the kernel without a fault, and
+      // the pages written are found afterwards from the page table.
+      //
+      bool wp_async( void ) { return m_wp_async; }
+      void scan_written_pages( RegionDescriptor* rd, bool protect, std::vector<char*>& pages );
+      char* alloc_staging_pages( void );
+      void free_staging_pages( char* staging );
+      char* move_out_page( RegionDescriptor* rd, void* page_address, char* staging );
 
     private:
+      //
+      // Every handler thread reads the faults of a userfaultfd of its own,
+      // on which a stripe of each region is registered.
+      //
+      // Faults that need a page descriptor when none is free are held back
+      // on the handler until the Buffer makes one available, which it tells
+      // the handler through avail_fd while deferring is set.
+      //
+      struct Fault {
+        char* addr;
+        bool  iswrite;
+        bool  throttled;      // Counted as held back for the dirty limit
+      };
+
+      struct Handler {
+        int                   fd;
+        std::vector<uffd_msg> events;
+        int                   avail_fd;       // eventfd
+        std::deque<Fault>     deferred;
+        std::atomic<bool>     deferring;
+      };
+
       RegionManager&        m_rm;
       uint64_t              m_max_fault_events;
       uint64_t              m_page_size;
       Buffer*               m_buffer;
-      int                   m_uffd_fd;
+      std::vector<Handler>  m_handlers;
+      std::atomic<uint64_t> m_next_thread;    // Handler of the next thread to start
+      std::atomic<uint64_t> m_num_deferring;  // Handlers with faults held back
+      uint64_t              m_next_region;    // Handler of the first stripe of the next region
       int                   m_pipe[2];
-      std::vector<uffd_msg> m_events;
+      uint64_t              m_features;       // Supported by the kernel
+      bool                  m_thread_ids;     // Faults carry the faulting thread
+      bool                  m_wp_async;       // Writes do not fault, see wp_async()
+      int                   m_pagemap;        // /proc/self/pagemap when m_wp_async
+      bool                  m_sigbus;         // Faults are raised as SIGBUS
+      SigbusWorkers*        m_sigbus_workers; // Resolve them when m_sigbus
+      StridePrefetcher      m_strides;
 
-      void uffd_handler( void );
+      void uffd_handler( Handler& h );
+      bool handle_fault( Fault& f );
+      void process_deferred( Handler& h );
       void ThreadEntry( void );
-      void check_uffd_compatibility( void );
+      uint64_t probe_uffd_features( void );
+      void check_uffd_compatibility( int fd );
+      bool probe_wp_async( void );
+      bool probe_sigbus( void );
+
+      //
+      // With UMAP_SIGBUS, the kernel raises SIGBUS in a thread that faults
+      // on a page of a region rather than putting it to sleep, and the
+      // signal handler has the fault resolved by the SIGBUS workers.
+      //
+      static Uffd* s_sigbus_uffd;
+      static struct sigaction s_old_sigbus;
+      static void sigbus_handler( int sig, siginfo_t* info, void* context );
+      void prefetch_stride( uint32_t tid, char* addr );
+
+      inline int fd_of( RegionDescriptor* rd, void* page_address ) {
+        return m_handlers[rd->uffd_handler_of((char*)page_address) % m_handlers.size()].fd;
+      }
   };
 } // end of namespace Umap
 #endif // _UMAP_Uffd_HPP
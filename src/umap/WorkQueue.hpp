@@ -44,32 +44,91 @@ class WorkQueue {
       pthread_mutex_unlock(&m_mutex);
     }
 
+    //
+    // Low priority items are only handed out when there is nothing else to
+    // do
+    //
+    void enqueue_low_priority(T item) {
+      pthread_mutex_lock(&m_mutex);
+      m_low_priority_queue.push_back(item);
+      pthread_cond_signal(&m_cond);
+      pthread_mutex_unlock(&m_mutex);
+    }
+
     T dequeue() {
       pthread_mutex_lock(&m_mutex);
 
       ++m_waiting_workers;
 
-      while ( m_queue.size() == 0 ) {
+      while ( m_queue.size() == 0 && m_low_priority_queue.size() == 0 ) {
         if (m_waiting_workers == m_max_waiting && m_idle_waiters)
-          pthread_cond_signal(&m_idle_cond);
+          pthread_cond_broadcast(&m_idle_cond);
 
         pthread_cond_wait(&m_cond, &m_mutex);
       }
 
       --m_waiting_workers;
 
-      auto item = m_queue.front();
-      m_queue.pop_front();
+      std::list<T>& q = m_queue.size() ? m_queue : m_low_priority_queue;
+      auto item = q.front();
+      q.pop_front();
 
       pthread_mutex_unlock(&m_mutex);
       return item;
     }
 
+    //
+    // Returns false rather than waiting if there is nothing to do
+    //
+    bool try_dequeue(T& item) {
+      pthread_mutex_lock(&m_mutex);
+
+      if ( m_queue.size() == 0 && m_low_priority_queue.size() == 0 ) {
+        pthread_mutex_unlock(&m_mutex);
+        return false;
+      }
+
+      std::list<T>& q = m_queue.size() ? m_queue : m_low_priority_queue;
+      item = q.front();
+      q.pop_front();
+
+      pthread_mutex_unlock(&m_mutex);
+      return true;
+    }
+
+    //
+    // Like try_dequeue(), but leaves the next item on the queue for another
+    // worker unless accept(item) is true
+    //
+    template <typename Accept>
+    bool try_dequeue_if(T& item, Accept accept) {
+      pthread_mutex_lock(&m_mutex);
+
+      if ( m_queue.size() == 0 && m_low_priority_queue.size() == 0 ) {
+        pthread_mutex_unlock(&m_mutex);
+        return false;
+      }
+
+      std::list<T>& q = m_queue.size() ? m_queue : m_low_priority_queue;
+
+      if ( ! accept(q.front()) ) {
+        pthread_mutex_unlock(&m_mutex);
+        return false;
+      }
+
+      item = q.front();
+      q.pop_front();
+
+      pthread_mutex_unlock(&m_mutex);
+      return true;
+    }
+
     void wait_for_idle( void ) {
       pthread_mutex_lock(&m_mutex);
       ++m_idle_waiters;
 
-      while ( ! ( m_queue.size() == 0 && m_waiting_workers == m_max_waiting ) )
+      while ( ! (    m_queue.size() == 0 && m_low_priority_queue.size() == 0
+                  && m_waiting_workers == m_max_waiting ) )
         pthread_cond_wait(&m_idle_cond, &m_mutex);
 
       --m_idle_waiters;
@@ -78,7 +137,7 @@ class WorkQueue {
 
     bool is_empty() {
       pthread_mutex_lock(&m_mutex);
-      bool empty = (m_queue.size() == 0);
+      bool empty = (m_queue.size() == 0 && m_low_priority_queue.size() == 0);
       pthread_mutex_unlock(&m_mutex);
       return empty;
     }
@@ -88,6 +147,7 @@ class WorkQueue {
     pthread_cond_t m_cond;
     pthread_cond_t m_idle_cond;
     std::list<T> m_queue;
+    std::list<T> m_low_priority_queue;
     uint64_t m_max_waiting;
     uint64_t m_waiting_workers;
     int m_idle_waiters;
@@ -18,15 +18,26 @@
 
 namespace Umap {
   struct WorkItem {
-    enum WorkType { NONE, EXIT, THRESHOLD, EVICT, FAST_EVICT, FLUSH };
+    enum WorkType { NONE, EXIT, THRESHOLD, EVICT, FAST_EVICT, FLUSH, READ_AHEAD };
     PageDescriptor* page_desc;
     WorkType type;
+
+    //
+    // A fill of more than one page covers num_pages pages from fill_start,
+    // page_desc being the one that was faulted on.  So does an eviction or
+    // flush of a run of pages, page_desc being the first of them.
+    //
+    char* fill_start;
+    uint64_t num_pages;
   };
 
   static std::ostream& operator<<(std::ostream& os, const Umap::WorkItem& b)
   {
     os << "{ page_desc: " << b.page_desc;
 
+    if ( b.num_pages > 1 )
+      os << ", fill_start: " << (void*)b.fill_start << ", num_pages: " << b.num_pages;
+
     switch (b.type) {
       default: os << ", type: Unknown(" << b.type << ")"; break;
       case Umap::WorkItem::WorkType::NONE: os << ", type: " << "NONE"; break;
@@ -35,6 +46,7 @@ namespace Umap {
       case Umap::WorkItem::WorkType::EVICT: os << ", type: " << "EVICT"; break;
       case Umap::WorkItem::WorkType::FAST_EVICT: os << ", type: " << "FAST_EVICT"; break;
       case Umap::WorkItem::WorkType::FLUSH: os << ", type: " << "FLUSH"; break;
+      case Umap::WorkItem::WorkType::READ_AHEAD: os << ", type: " << "READ_AHEAD"; break;
     }
 
     os << " }";
@@ -61,10 +73,23 @@ namespace Umap {
         m_wq->enqueue(work);
       }
 
+      void send_low_priority_work(const WorkItem& work) {
+        m_wq->enqueue_low_priority(work);
+      }
+
       WorkItem get_work() {
         return m_wq->dequeue();
       }
 
+      bool try_get_work(WorkItem& work) {
+        return m_wq->try_dequeue(work);
+      }
+
+      template <typename Accept>
+      bool try_get_work_if(WorkItem& work, Accept accept) {
+        return m_wq->try_dequeue_if(work, accept);
+      }
+
       bool wq_is_empty( void ) {
         return m_wq->is_empty();
       }
@@ -90,7 +115,9 @@ namespace Umap {
         UMAP_LOG(Debug, "Stopping " <<  m_pool_name << " Pool of "
             << m_num_threads << " threads");
 
-        WorkItem w = {.page_desc = nullptr, .type = Umap::WorkItem::WorkType::EXIT };
+        WorkItem w = {};
+
+        w.type = Umap::WorkItem::WorkType::EXIT;
 
         //
         // This will inform all of the threads it is time to go away
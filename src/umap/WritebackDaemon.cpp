@@ -0,0 +1,93 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#include <errno.h>
+#include <time.h>
+
+#include "umap/Buffer.hpp"
+#include "umap/RegionManager.hpp"
+#include "umap/WritebackDaemon.hpp"
+#include "umap/util/Macros.hpp"
+
+namespace Umap {
+
+static const int WRITEBACK_INTERVAL = 1;      // Seconds between looks
+
+void WritebackDaemon::writeback( void )
+{
+  pthread_mutex_lock(&m_mutex);
+
+  while ( m_running ) {
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += WRITEBACK_INTERVAL;
+
+    int err = 0;
+    while ( m_running && ! m_kicked && err != ETIMEDOUT )
+      err = pthread_cond_timedwait(&m_cond, &m_mutex, &deadline);
+
+    if ( ! m_running )
+      break;
+
+    m_kicked = false;
+    pthread_mutex_unlock(&m_mutex);
+
+    m_rm.harvest_written_pages();
+    m_buffer->write_back_dirty_pages();
+
+    pthread_mutex_lock(&m_mutex);
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+}
+
+//
+// Called by the Buffer as pages become dirty while more of them are than
+// the background threshold.  Only the first kick after a pass takes the
+// lock.
+//
+void WritebackDaemon::kick( void )
+{
+  if ( m_kicked.exchange(true) )
+    return;
+
+  pthread_mutex_lock(&m_mutex);
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+WritebackDaemon::WritebackDaemon( Buffer* buffer )
+  :   m_rm(RegionManager::getInstance())
+    , m_buffer(buffer)
+    , m_running(true)
+    , m_kicked(false)
+{
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_cond_init(&m_cond, NULL);
+
+  UMAP_LOG(Info, "background ratio " << m_rm.get_dirty_background_ratio()
+      << "%, dirty ratio " << m_rm.get_dirty_ratio() << "%");
+
+  int ret = pthread_create(&m_thread, NULL, WritebackThreadEntryFunc, this);
+  if (ret) {
+    UMAP_ERROR("Failed to launch the writeback thread");
+  }
+}
+
+WritebackDaemon::~WritebackDaemon( void )
+{
+  pthread_mutex_lock(&m_mutex);
+  m_running = false;
+  pthread_cond_signal(&m_cond);
+  pthread_mutex_unlock(&m_mutex);
+
+  pthread_join(m_thread, NULL);
+
+  pthread_cond_destroy(&m_cond);
+  pthread_mutex_destroy(&m_mutex);
+}
+} // end of namespace Umap
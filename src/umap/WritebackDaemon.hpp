@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_WritebackDaemon_HPP
+#define _UMAP_WritebackDaemon_HPP
+
+#include <atomic>
+#include <pthread.h>
+
+namespace Umap {
+  class Buffer;
+  class RegionManager;
+
+  //
+  // Writes dirty pages back to their stores in the background once more
+  // of the Umap Buffer than UMAP_DIRTY_BACKGROUND_RATIO is dirty, so that
+  // eviction mostly finds clean pages and a flush has little left to do.
+  // The daemon is kicked by the Buffer as pages become dirty, and also
+  // looks once a second, which is when pages written under asynchronous
+  // write protection are found.
+  //
+  class WritebackDaemon {
+    public:
+      WritebackDaemon( Buffer* buffer );
+      ~WritebackDaemon( void );
+
+      void kick( void );
+
+    private:
+      RegionManager& m_rm;
+      Buffer* m_buffer;
+
+      bool m_running;
+      std::atomic<bool> m_kicked;
+      pthread_mutex_t m_mutex;
+      pthread_cond_t m_cond;
+      pthread_t m_thread;
+
+      void writeback( void );
+      static void* WritebackThreadEntryFunc( void* obj ) {
+        ((WritebackDaemon*)obj)->writeback();
+        return NULL;
+      }
+  };
+} // end of namespace Umap
+#endif // _UMAP_WritebackDaemon_HPP
@@ -9,6 +9,7 @@
 #define _GNU_SOURCE
 #endif
 
+#include <algorithm>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -102,27 +103,47 @@ namespace Umap {
       delete [] file_descriptors;
     }
 
+    //
+    // A read or write of more than one page may span files, so it is done
+    // one file at a time
+    //
     ssize_t SparseStore::read_from_store(char* buf, size_t nb, off_t off) {
       ssize_t read = 0;
-      off_t file_offset;
-      int fd = get_fd(off, file_offset); 
-      read = pread(fd,buf,nb,file_offset);
-      if(read == -1){
-        UMAP_ERROR("pread(fd=" << fd << ", buff=" << (void*)buf <<  ", nb=" << nb << ", off=" << off << ") Failed - " << strerror(errno));
+
+      while (nb > 0) {
+        off_t file_offset;
+        int fd = get_fd(off, file_offset);
+        size_t len = std::min(nb, file_size - (size_t)file_offset);
+        ssize_t rval = pread(fd,buf,len,file_offset);
+        if(rval == -1){
+          UMAP_ERROR("pread(fd=" << fd << ", buff=" << (void*)buf <<  ", nb=" << len << ", off=" << off << ") Failed - " << strerror(errno));
+        }
+        numreads++;
+        read += rval;
+        if ((size_t)rval < len)
+          break;
+        buf += rval; nb -= rval; off += rval;
       }
-      numreads++;
       return read;
     }
 
     ssize_t SparseStore::write_to_store(char* buf, size_t nb, off_t off) {
       ssize_t written = 0;
-      off_t file_offset;
-      int fd = get_fd(off, file_offset);
-      written = pwrite(fd,buf,nb,file_offset);
-      if(written == -1){
-        UMAP_ERROR("pwrite(fd=" << fd << ", buff=" << (void*)buf <<  ", nb=" << nb << ", off=" << off << ") Failed - " << strerror(errno));
+
+      while (nb > 0) {
+        off_t file_offset;
+        int fd = get_fd(off, file_offset);
+        size_t len = std::min(nb, file_size - (size_t)file_offset);
+        ssize_t rval = pwrite(fd,buf,len,file_offset);
+        if(rval == -1){
+          UMAP_ERROR("pwrite(fd=" << fd << ", buff=" << (void*)buf <<  ", nb=" << len << ", off=" << off << ") Failed - " << strerror(errno));
+        }
+        numwrites++;
+        written += rval;
+        if ((size_t)rval < len)
+          break;
+        buf += rval; nb -= rval; off += rval;
       }
-      numwrites++;
       return written;
     }
 
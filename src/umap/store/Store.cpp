@@ -13,4 +13,16 @@ namespace Umap {
   {
     return new StoreFile{_region_, _rsize_, _alignsize_, _fd_};
   }
+
+  void Store::submit_read_v(StoreRequest* reqs, size_t n)
+  {
+    for ( size_t i = 0; i < n; ++i )
+      reqs[i].result = read_from_store(reqs[i].buf, reqs[i].nb, reqs[i].off);
+  }
+
+  void Store::submit_write_v(StoreRequest* reqs, size_t n)
+  {
+    for ( size_t i = 0; i < n; ++i )
+      reqs[i].result = write_to_store(reqs[i].buf, reqs[i].nb, reqs[i].off);
+  }
 }
@@ -10,12 +10,55 @@
 #include <unistd.h>
 
 namespace Umap {
+//
+// One of a batch of reads or writes handed to a store at once.  result is
+// set to what read_from_store() or write_to_store() would have returned.
+//
+struct StoreRequest {
+  char*       buf;
+  std::size_t nb;
+  off_t       off;
+  ssize_t     result;
+};
+
 class Store {
   public:
     static Store* make_store(void* _region_, std::size_t _rsize_, std::size_t _alignsize_, int _fd_);
 
+    virtual ~Store() {}
+
     virtual ssize_t read_from_store(char* buf, std::size_t nb, off_t off) = 0;
     virtual ssize_t  write_to_store(char* buf, std::size_t nb, off_t off) = 0;
+
+    //
+    // A store kept in a file may tell where in it nb bytes at off are, so
+    // that they can be read with io_uring.  Returns false if they can only
+    // be read with read_from_store().
+    //
+    virtual bool read_fd(off_t, std::size_t, int*, off_t*) { return false; }
+
+    //
+    // Batches of n reads or writes.  The requests of a batch may be done in
+    // any order, merged, or done concurrently, and submit_*_v() may return
+    // before they are done.  Their results are only known once
+    // complete_v() has been called for the batch with the same requests.
+    // By default each request is done in turn with read_from_store() or
+    // write_to_store() as the batch is submitted, so stores only need to
+    // override these to do better.
+    //
+    virtual void submit_read_v(StoreRequest* reqs, std::size_t n);
+    virtual void submit_write_v(StoreRequest* reqs, std::size_t n);
+    virtual void complete_v(StoreRequest*, std::size_t) {}
+
+    void read_from_store_v(StoreRequest* reqs, std::size_t n) {
+      submit_read_v(reqs, n);
+      complete_v(reqs, n);
+    }
+
+    void write_to_store_v(StoreRequest* reqs, std::size_t n) {
+      submit_write_v(reqs, n);
+      complete_v(reqs, n);
+    }
 };
 } // end of namespace Umap
 #endif
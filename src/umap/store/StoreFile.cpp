@@ -7,9 +7,13 @@
 #include <unistd.h>
 #include <stdio.h>
 #include "StoreFile.h"
+#include <algorithm>
+#include <climits>              // IOV_MAX
 #include <iostream>
 #include <sstream>
 #include <string.h>
+#include <sys/uio.h>            // preadv(), pwritev()
+#include <vector>
 
 #include "umap/store/Store.hpp"
 #include "umap/util/Macros.hpp"
@@ -57,4 +61,72 @@ namespace Umap {
     }
     return rval;
   }
+
+  bool StoreFile::read_fd(off_t off, size_t, int* _fd_, off_t* file_off)
+  {
+    *_fd_ = fd;
+    *file_off = off;
+    return true;
+  }
+
+  void StoreFile::submit_read_v(StoreRequest* reqs, size_t n)
+  {
+    transfer_v(reqs, n, false);
+  }
+
+  void StoreFile::submit_write_v(StoreRequest* reqs, size_t n)
+  {
+    transfer_v(reqs, n, true);
+  }
+
+  //
+  // Requests that follow one another in the file are done with a single
+  // preadv() or pwritev(), in whatever order they were given
+  //
+  void StoreFile::transfer_v(StoreRequest* reqs, size_t n, bool write)
+  {
+    std::vector<StoreRequest*> order(n);
+    std::vector<struct iovec> iov;
+
+    for ( size_t i = 0; i < n; ++i )
+      order[i] = &reqs[i];
+
+    std::sort(order.begin(), order.end(),
+        [](const StoreRequest* a, const StoreRequest* b) { return a->off < b->off; });
+
+    for ( size_t i = 0; i < n; ) {
+      off_t off = order[i]->off;
+      off_t end = off;
+      size_t j = i;
+
+      iov.clear();
+      while ( j < n && order[j]->off == end && iov.size() < IOV_MAX ) {
+        iov.push_back({ order[j]->buf, order[j]->nb });
+        end += order[j]->nb;
+        ++j;
+      }
+
+      UMAP_LOG(Debug, (write ? "pwritev" : "preadv") << "(fd=" << fd
+                      << ", iovcnt=" << iov.size() << ", off=" << off << ")";);
+
+      ssize_t rval = write ? pwritev(fd, iov.data(), iov.size(), off)
+                           : preadv(fd, iov.data(), iov.size(), off);
+
+      if (rval == -1) {
+        int eno = errno;
+        UMAP_ERROR((write ? "pwritev" : "preadv") << "(fd=" << fd
+                        << ", iovcnt=" << iov.size() << ", nb=" << end - off
+                        << ", off=" << off << "): Failed - " << strerror(eno));
+      }
+
+      //
+      // What was done is handed out in file order, so that a read cut short
+      // by the end of the file is short for the request it ends in
+      //
+      for ( ; i < j; ++i ) {
+        order[i]->result = std::min(rval, (ssize_t)order[i]->nb);
+        rval -= order[i]->result;
+      }
+    }
+  }
 }
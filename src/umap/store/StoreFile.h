@@ -17,12 +17,17 @@ namespace Umap {
 
       ssize_t read_from_store(char* buf, size_t nb, off_t off);
       ssize_t  write_to_store(char* buf, size_t nb, off_t off);
+      bool read_fd(off_t off, size_t nb, int* fd, off_t* file_off);
+      void submit_read_v(StoreRequest* reqs, size_t n);
+      void submit_write_v(StoreRequest* reqs, size_t n);
     private:
       void* region;
       void* alignment_buffer;
       size_t rsize;
       size_t alignsize;
       int fd;
+
+      void transfer_v(StoreRequest* reqs, size_t n, bool write);
   };
 }
 #endif
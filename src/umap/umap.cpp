@@ -75,6 +75,21 @@ void umap_fetch_and_pin( char* paddr, uint64_t size )
   Umap::RegionManager::getInstance().fetch_and_pin(paddr, size);
 }
 
+int umap_pin( void* addr, uint64_t length )
+{
+  return Umap::RegionManager::getInstance().pin((char*)addr, length);
+}
+
+int umap_unpin( void* addr, uint64_t length )
+{
+  return Umap::RegionManager::getInstance().unpin((char*)addr, length);
+}
+
+int umap_set_fault_around( void* addr, uint64_t bytes )
+{
+  return Umap::RegionManager::getInstance().set_fault_around((char*)addr, bytes);
+}
+
 
 long
 umapcfg_get_system_page_size( void )
@@ -88,6 +103,18 @@ umapcfg_get_max_pages_in_buffer( void )
   return Umap::RegionManager::getInstance().get_max_pages_in_buffer();
 }
 
+uint64_t
+umapcfg_get_max_pinned_pages( void )
+{
+  return Umap::RegionManager::getInstance().get_max_pinned_pages();
+}
+
+int
+umapcfg_set_max_pages_in_buffer( uint64_t max_pages )
+{
+  return Umap::RegionManager::getInstance().set_max_pages_in_buffer(max_pages);
+}
+
 uint64_t
 umapcfg_get_umap_page_size( void )
 {
@@ -100,12 +127,48 @@ umapcfg_get_num_fillers( void )
   return Umap::RegionManager::getInstance().get_num_fillers();
 }
 
+uint64_t
+umapcfg_get_fill_queue_depth( void )
+{
+  return Umap::RegionManager::getInstance().get_fill_queue_depth();
+}
+
 uint64_t
 umapcfg_get_num_evictors( void )
 {
   return Umap::RegionManager::getInstance().get_num_evictors();
 }
 
+uint64_t
+umapcfg_get_num_buffer_shards( void )
+{
+  return Umap::RegionManager::getInstance().get_num_buffer_shards();
+}
+
+uint64_t
+umapcfg_get_num_uffd_threads( void )
+{
+  return Umap::RegionManager::getInstance().get_num_uffd_threads();
+}
+
+uint64_t
+umapcfg_get_read_ahead( void )
+{
+  return Umap::RegionManager::getInstance().get_read_ahead();
+}
+
+uint64_t
+umapcfg_get_fault_around_bytes( void )
+{
+  return Umap::RegionManager::getInstance().get_fault_around_bytes();
+}
+
+const char*
+umapcfg_get_evict_policy( void )
+{
+  return Umap::RegionManager::getInstance().get_evict_policy().c_str();
+}
+
 int
 umapcfg_get_evict_low_water_threshold( void )
 {
@@ -209,7 +272,7 @@ umap_ex(
   if ( store == nullptr )
     store = Store::make_store(umap_region, umap_size, umap_psize, fd);
 
-  rm.addRegion(store, (char*)umap_region, umap_size, (char*)mmap_region, mmap_size);
+  rm.addRegion(store, (char*)umap_region, umap_size, (char*)mmap_region, mmap_size, prot);
 
   return umap_region;
 }
@@ -73,12 +73,28 @@ int umap_has_write_support();
   
 void umap_prefetch( int npages, struct umap_prefetch_item* page_array );
 void umap_fetch_and_pin( char* paddr, uint64_t size );  
+int umap_pin( void* addr, uint64_t length );
+int umap_unpin( void* addr, uint64_t length );
+int umap_set_fault_around( void* addr, uint64_t bytes );
 uint64_t umapcfg_get_umap_page_size( void );
 uint64_t umapcfg_get_max_fault_events( void );
 uint64_t umapcfg_get_num_fillers( void );
+uint64_t umapcfg_get_fill_queue_depth( void );
 uint64_t umapcfg_get_num_evictors( void );
+uint64_t umapcfg_get_num_buffer_shards( void );
+uint64_t umapcfg_get_num_uffd_threads( void );
+const char* umapcfg_get_evict_policy( void );
 uint64_t umapcfg_get_max_pages_in_buffer( void );
+uint64_t umapcfg_get_max_pinned_pages( void );
+/** Change the number of pages the Umap Buffer may hold, evicting pages
+ * when it shrinks below what is present
+ * \param max_pages Between 1 and the number of umap pages that fit in memory
+ * \return 0 on success, or -1 with errno set to EINVAL if max_pages is out
+ *         of range
+ */
+int      umapcfg_set_max_pages_in_buffer( uint64_t max_pages );
 uint64_t umapcfg_get_read_ahead( void );
+uint64_t umapcfg_get_fault_around_bytes( void );
 int      umapcfg_get_evict_low_water_threshold( void );
 int      umapcfg_get_evict_high_water_threshold( void );
 
@@ -0,0 +1,99 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that a fault brings in the aligned cluster of pages set with
+ * umap_set_fault_around(), rounded down to a power of two pages, with the
+ * contents of the store, and no page outside of it.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 64;
+
+//
+// Faults on page and checks that exactly the pages [first, first+n) of the
+// neighbourhood of page came in with it.  Neighbourhoods must not hold pages
+// brought in before.
+//
+static void
+check_cluster(  char* base, uint64_t psize, uint64_t page
+              , uint64_t first, uint64_t n )
+{
+  volatile uint64_t* word = (uint64_t*)(base + page * psize);
+
+  CHECK( *word == page * psize / sizeof(uint64_t) );
+
+  for ( uint64_t p = (first >= 8 ? first - 8 : 0); p < first + n + 8 && p < num_pages; ++p )
+    CHECK( utility::resident(base + p * psize) == (p >= first && p < first + n) );
+
+  for ( uint64_t p = first; p < first + n; ++p )
+    CHECK( *(uint64_t*)(base + p * psize) == p * psize / sizeof(uint64_t) );
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  //
+  // Read-ahead would bring in pages of its own
+  //
+  setenv("UMAP_READ_AHEAD", "1", 1);
+  unsetenv("UMAP_FAULT_AROUND_BYTES");
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+
+  uint64_t* init = new uint64_t[words];
+  for ( uint64_t i = 0; i < words; ++i )
+    init[i] = i;
+  CHECK( pwrite(fd, init, length, 0) == (ssize_t)length );
+  delete [] init;
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+
+  char other[1];
+  CHECK( umap_set_fault_around(other, 8 * psize) == -1 && errno == EINVAL );
+
+  // Off by default
+  check_cluster(base, psize, 2, 2, 1);
+
+  CHECK( umap_set_fault_around(base, 8 * psize) == 0 );
+  check_cluster(base, psize, 21, 16, 8);
+
+  // 6 pages are rounded down to 4
+  CHECK( umap_set_fault_around(base + psize, 6 * psize) == 0 );
+  check_cluster(base, psize, 41, 40, 4);
+
+  CHECK( umap_set_fault_around(base, psize) == 0 );
+  check_cluster(base, psize, 60, 60, 1);
+
+  CHECK( uunmap(base, length) == 0 );
+
+  close(fd);
+  std::cout << "fault_around: OK\n";
+  return 0;
+}
@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that what several threads write to a region much larger than the
+ * Umap Buffer is what they read back, what reaches the file on a flush,
+ * and what a read-only mapping of the file shows.  Threads write pages
+ * strided across the region, then read their own part of it in order and
+ * write it again, and finally read it backwards.
+ *
+ * The runs registered with ctest go through it under the settings of the
+ * environment that change how pages are brought in and evicted.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 256;
+static const uint64_t num_threads = 4;
+
+static uint64_t
+value( uint64_t i, uint64_t pass )
+{
+  return i * 3 + 1 + pass;
+}
+
+template <typename F>
+static void
+in_threads( F f )
+{
+  std::vector<std::thread> threads;
+
+  for ( uint64_t t = 0; t < num_threads; ++t )
+    threads.push_back(std::thread(f, t));
+
+  for ( auto& t : threads )
+    t.join();
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  //
+  // Runs may choose a size of their own
+  //
+  setenv("UMAP_BUFSIZE", "32", 0);
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+  uint64_t words_per_page = psize / sizeof(uint64_t);
+  uint64_t part = words / num_threads;
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+  CHECK( ftruncate(fd, length) == 0 );
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  uint64_t* arr = (uint64_t*)base;
+
+  in_threads([=]( uint64_t t ) {
+    for ( uint64_t p = t; p < num_pages; p += num_threads )
+      for ( uint64_t i = p * words_per_page; i < (p + 1) * words_per_page; ++i )
+        arr[i] = value(i, 0);
+  });
+
+  //
+  // Pages that are still present after being read fault again on the write
+  //
+  in_threads([=]( uint64_t t ) {
+    for ( uint64_t i = t * part; i < (t + 1) * part; ++i )
+      CHECK( arr[i] == value(i, 0) );
+
+    for ( uint64_t i = t * part; i < (t + 1) * part; ++i )
+      arr[i] = value(i, 1);
+  });
+
+  CHECK( umap_flush() == 0 );
+
+  uint64_t* out = new uint64_t[words];
+  CHECK( pread(fd, out, length, 0) == (ssize_t)length );
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( out[i] == value(i, 1) );
+  delete [] out;
+
+  CHECK( uunmap(base, length) == 0 );
+
+  base = (char*)umap(NULL, length, PROT_READ, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  arr = (uint64_t*)base;
+
+  in_threads([=]( uint64_t t ) {
+    for ( uint64_t i = (t + 1) * part; i > t * part; --i )
+      CHECK( arr[i - 1] == value(i - 1, 1) );
+  });
+
+  CHECK( uunmap(base, length) == 0 );
+
+  close(fd);
+  std::cout << "integrity: OK\n";
+  return 0;
+}
@@ -0,0 +1,110 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that umap_pin() keeps pages resident while the rest of the region
+ * is cycled through a small buffer, that pins are refused once the pinned
+ * page budget is used up, and that umap_unpin() gives the budget back.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 64;
+static const uint64_t buf_pages = 16;
+static const uint64_t pinned_pages = 8;
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  //
+  // The configuration is read when umap is first used
+  //
+  setenv("UMAP_BUFSIZE", std::to_string(buf_pages).c_str(), 1);
+  setenv("UMAP_PINNED_BUFSIZE", std::to_string(pinned_pages).c_str(), 1);
+  setenv("UMAP_READ_AHEAD", "1", 1);
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+
+  CHECK( umapcfg_get_max_pinned_pages() == pinned_pages );
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+
+  uint64_t* init = new uint64_t[words];
+  for ( uint64_t i = 0; i < words; ++i )
+    init[i] = i;
+  CHECK( pwrite(fd, init, length, 0) == (ssize_t)length );
+  delete [] init;
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  uint64_t* arr = (uint64_t*)base;
+
+  char other[1];
+  CHECK( umap_pin(other, psize) == -1 && errno == EINVAL );
+  CHECK( umap_unpin(other, psize) == -1 && errno == EINVAL );
+
+  CHECK( umap_pin(base, (pinned_pages + 1) * psize) == -1 && errno == ENOMEM );
+
+  CHECK( umap_pin(base, pinned_pages * psize) == 0 );
+  for ( uint64_t p = 0; p < pinned_pages; ++p )
+    CHECK( utility::resident(base + p * psize) );
+
+  //
+  // Pinning pages that are already pinned takes nothing more from the
+  // budget, but any other page does
+  //
+  CHECK( umap_pin(base, pinned_pages * psize) == 0 );
+  CHECK( umap_pin(base + pinned_pages * psize, psize) == -1 && errno == ENOMEM );
+
+  //
+  // Write every page twice over, which is more than the buffer holds
+  //
+  for ( int pass = 0; pass < 2; ++pass ) {
+    for ( uint64_t i = 0; i < words; ++i )
+      arr[i] += 1;
+  }
+
+  for ( uint64_t p = 0; p < pinned_pages; ++p )
+    CHECK( utility::resident(base + p * psize) );
+
+  CHECK( umap_unpin(base, pinned_pages * psize) == 0 );
+  CHECK( umap_pin(base + (num_pages - pinned_pages) * psize, pinned_pages * psize) == 0 );
+  CHECK( umap_unpin(base + (num_pages - pinned_pages) * psize, pinned_pages * psize) == 0 );
+
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( arr[i] == i + 2 );
+
+  CHECK( uunmap(base, length) == 0 );
+
+  uint64_t* out = new uint64_t[words];
+  CHECK( pread(fd, out, length, 0) == (ssize_t)length );
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( out[i] == i + 2 );
+  delete [] out;
+
+  close(fd);
+  std::cout << "pin: OK\n";
+  return 0;
+}
@@ -0,0 +1,152 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that the Umap Buffer may not be made larger than the memory of the
+ * system or the limit of the memory cgroup of the process, and that pages
+ * cycled through the buffer while the pressure monitor samples keep what
+ * was written to them.  Whether there is memory pressure is up to the
+ * system, so the monitor is not made to resize the buffer here.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 256;
+static const uint64_t buf_pages = 64;
+
+static uint64_t
+mem_total( void )
+{
+  std::ifstream file("/proc/meminfo");
+  std::string token;
+  uint64_t kb;
+
+  while ( file >> token ) {
+    if ( token == "MemTotal:" && file >> kb )
+      return kb * 1024;
+    file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+  }
+  CHECK( ! "MemTotal in /proc/meminfo" );
+  return 0;
+}
+
+//
+// The memory limit of the cgroup of this process, or 0 if there is none
+// to be found.  With cgroup v1 "no limit" is a very large number.
+//
+static uint64_t
+cgroup_limit( void )
+{
+  std::ifstream file("/proc/self/cgroup");
+  std::string line;
+  std::string v1_path, v2_path;
+
+  while ( std::getline(file, line) ) {
+    std::string::size_type first = line.find(':');
+    std::string::size_type second = line.find(':', first + 1);
+
+    if ( first == std::string::npos || second == std::string::npos )
+      continue;
+
+    std::string controllers = line.substr(first + 1, second - first - 1);
+    std::string path = line.substr(second + 1);
+
+    if ( controllers.empty() )
+      v2_path = path;
+    else if ( (',' + controllers + ',').find(",memory,") != std::string::npos )
+      v1_path = path;
+  }
+
+  const std::string files[] = {
+      "/sys/fs/cgroup/memory" + v1_path + "/memory.limit_in_bytes"
+    , "/sys/fs/cgroup" + v2_path + "/memory.max"
+  };
+
+  for ( auto& f : files ) {
+    std::ifstream limit(f);
+    uint64_t bytes;
+
+    if ( limit >> bytes )
+      return bytes < (1ULL << 62) ? bytes : 0;
+  }
+  return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  setenv("UMAP_BUFSIZE", std::to_string(buf_pages).c_str(), 1);
+  setenv("UMAP_PRESSURE_MONITOR_FREQ", "1", 1);
+  setenv("UMAP_READ_AHEAD", "1", 1);
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+
+  uint64_t too_big = mem_total() / psize + 1;
+  CHECK( umapcfg_set_max_pages_in_buffer(too_big) == -1 && errno == EINVAL );
+
+  uint64_t limit = cgroup_limit();
+  if ( limit != 0 ) {
+    too_big = limit / psize + 1;
+    CHECK( umapcfg_set_max_pages_in_buffer(too_big) == -1 && errno == EINVAL );
+  }
+  CHECK( umapcfg_get_max_pages_in_buffer() == buf_pages );
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+  CHECK( ftruncate(fd, length) == 0 );
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  uint64_t* arr = (uint64_t*)base;
+
+  //
+  // Long enough for a few samples
+  //
+  for ( int pass = 0; pass < 6; ++pass ) {
+    for ( uint64_t i = 0; i < words; ++i )
+      arr[i] = i + pass;
+
+    CHECK( utility::count_resident(base, psize, num_pages) <= buf_pages );
+    usleep(500000);
+  }
+
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( arr[i] == i + 5 );
+
+  CHECK( uunmap(base, length) == 0 );
+
+  uint64_t* out = new uint64_t[words];
+  CHECK( pread(fd, out, length, 0) == (ssize_t)length );
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( out[i] == i + 5 );
+  delete [] out;
+
+  close(fd);
+  std::cout << "pressure: OK\n";
+  return 0;
+}
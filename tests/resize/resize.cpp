@@ -0,0 +1,107 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that umapcfg_set_max_pages_in_buffer() refuses sizes out of range,
+ * that shrinking the buffer while a region is mapped evicts pages down to
+ * the new size without losing what was written to them, and that growing
+ * it again lets more pages be present.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 256;
+static const uint64_t buf_pages = 128;
+static const uint64_t small_pages = 16;
+
+//
+// Eviction after a shrink is done in the background
+//
+static bool
+settles_within( char* base, uint64_t psize, uint64_t max_resident )
+{
+  for ( int i = 0; i < 500; ++i ) {
+    if ( utility::count_resident(base, psize, num_pages) <= max_resident )
+      return true;
+    usleep(10000);
+  }
+  return false;
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  setenv("UMAP_BUFSIZE", std::to_string(buf_pages).c_str(), 1);
+  setenv("UMAP_READ_AHEAD", "1", 1);
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+
+  CHECK( umapcfg_get_max_pages_in_buffer() == buf_pages );
+  CHECK( umapcfg_set_max_pages_in_buffer(0) == -1 && errno == EINVAL );
+  CHECK( umapcfg_set_max_pages_in_buffer(UINT64_MAX) == -1 && errno == EINVAL );
+  CHECK( umapcfg_get_max_pages_in_buffer() == buf_pages );
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+  CHECK( ftruncate(fd, length) == 0 );
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  uint64_t* arr = (uint64_t*)base;
+
+  //
+  // The last buf_pages pages written are left present and dirty
+  //
+  for ( uint64_t i = 0; i < words; ++i )
+    arr[i] = i + 1;
+
+  CHECK( umapcfg_set_max_pages_in_buffer(small_pages) == 0 );
+  CHECK( umapcfg_get_max_pages_in_buffer() == small_pages );
+  CHECK( settles_within(base, psize, small_pages) );
+
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( arr[i] == i + 1 );
+  CHECK( utility::count_resident(base, psize, num_pages) <= small_pages );
+
+  CHECK( umapcfg_set_max_pages_in_buffer(buf_pages) == 0 );
+  CHECK( umapcfg_get_max_pages_in_buffer() == buf_pages );
+
+  for ( uint64_t i = 0; i < words; ++i )
+    arr[i] += 1;
+
+  uint64_t resident = utility::count_resident(base, psize, num_pages);
+  CHECK( resident > small_pages && resident <= buf_pages );
+
+  CHECK( uunmap(base, length) == 0 );
+
+  uint64_t* out = new uint64_t[words];
+  CHECK( pread(fd, out, length, 0) == (ssize_t)length );
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( out[i] == i + 2 );
+  delete [] out;
+
+  close(fd);
+  std::cout << "resize: OK\n";
+  return 0;
+}
@@ -0,0 +1,146 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks the batched reads and writes of a Store, both those of a file
+ * store, which merges requests that follow one another in the file, and
+ * the ones every store gets by default.  Requests are given out of order,
+ * and a read that runs past the end of the store must come up short for
+ * the request the end falls in and empty for those after it.
+ */
+#include <algorithm>
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const std::size_t chunk = 4096;
+static const std::size_t store_size = 2 * chunk + chunk / 2;
+
+//
+// A store that only does single reads and writes, so batches go through
+// the defaults of Store
+//
+class MemoryStore : public Umap::Store {
+  public:
+    MemoryStore( void ) : m_data(store_size, 0) {}
+
+    ssize_t read_from_store(char* buf, std::size_t nb, off_t off) {
+      if ( (std::size_t)off >= m_data.size() )
+        return 0;
+
+      nb = std::min(nb, m_data.size() - off);
+      memcpy(buf, &m_data[off], nb);
+      return nb;
+    }
+
+    ssize_t write_to_store(char* buf, std::size_t nb, off_t off) {
+      if ( off + nb > m_data.size() )
+        m_data.resize(off + nb);
+
+      memcpy(&m_data[off], buf, nb);
+      return nb;
+    }
+
+  private:
+    std::vector<char> m_data;
+};
+
+static char
+pattern( std::size_t off )
+{
+  return (char)(off * 7 + 3);
+}
+
+static Umap::StoreRequest
+request( char* buf, std::size_t nb, off_t off )
+{
+  Umap::StoreRequest r;
+
+  r.buf = buf;
+  r.nb = nb;
+  r.off = off;
+  r.result = -2;
+  return r;
+}
+
+static void
+check_store( Umap::Store* store, const char* name )
+{
+  std::vector<char> out(store_size);
+  std::vector<char> in(5 * chunk, 0);
+
+  for ( std::size_t i = 0; i < store_size; ++i )
+    out[i] = pattern(i);
+
+  //
+  // The whole store in three pieces, out of order
+  //
+  Umap::StoreRequest writes[] = {
+      request(&out[chunk], chunk, chunk)
+    , request(&out[0], chunk, 0)
+    , request(&out[2 * chunk], chunk / 2, 2 * chunk)
+  };
+
+  store->write_to_store_v(writes, 3);
+  for ( auto& w : writes )
+    CHECK( w.result == (ssize_t)w.nb );
+
+  //
+  // The last chunk holds the end of the store and the one after it is past
+  // it, while the first is apart from the rest
+  //
+  Umap::StoreRequest reads[] = {
+      request(&in[3 * chunk], chunk, 3 * chunk)
+    , request(&in[chunk], chunk, chunk)
+    , request(&in[2 * chunk], chunk, 2 * chunk)
+    , request(&in[0], chunk / 4, 0)
+  };
+
+  store->read_from_store_v(reads, 4);
+
+  CHECK( reads[0].result == 0 );
+  CHECK( reads[1].result == (ssize_t)chunk );
+  CHECK( reads[2].result == (ssize_t)(chunk / 2) );
+  CHECK( reads[3].result == (ssize_t)(chunk / 4) );
+
+  for ( std::size_t i = 0; i < chunk / 4; ++i )
+    CHECK( in[i] == pattern(i) );
+  for ( std::size_t i = chunk; i < store_size; ++i )
+    CHECK( in[i] == pattern(i) );
+
+  std::cout << name << ": OK\n";
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+
+  Umap::Store* file_store = Umap::Store::make_store(nullptr, store_size, chunk, fd);
+  check_store(file_store, "file store");
+  delete file_store;
+  close(fd);
+
+  MemoryStore memory_store;
+  check_store(&memory_store, "default batches");
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+#ifndef _UMAP_CHECK_HPP_
+#define _UMAP_CHECK_HPP_
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//
+// Fails the check program with the line of the condition that did not hold
+//
+#define CHECK(cond)                                                       \
+  do {                                                                    \
+    if ( ! (cond) ) {                                                     \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond " failed\n"; \
+      exit(1);                                                            \
+    }                                                                     \
+  } while (0)
+
+namespace utility {
+
+//
+// Whether the first system page of page is present
+//
+static inline bool resident( char* page )
+{
+  unsigned char vec;
+
+  CHECK( mincore(page, sysconf(_SC_PAGESIZE), &vec) == 0 );
+  return (vec & 1) != 0;
+}
+
+static inline uint64_t count_resident( char* base, uint64_t psize, uint64_t num_pages )
+{
+  uint64_t n = 0;
+
+  for ( uint64_t p = 0; p < num_pages; ++p )
+    n += resident(base + p * psize);
+  return n;
+}
+
+} // namespace utility
+#endif // _UMAP_CHECK_HPP_
@@ -0,0 +1,52 @@
+#############################################################################
+# Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+# UMAP Project Developers. See the top-level LICENSE file for details.
+#
+# SPDX-License-Identifier: LGPL-2.1-only
+#############################################################################
+
+#
+# umap_check(<name>)
+#
+# Builds the check program <name> from <name>.cpp in the calling directory
+# and installs it.  A check program takes the file to map as its only
+# argument, and is run by ctest on a file of its own in the build tree.
+#
+function(umap_check name)
+  add_executable(${name} ${name}.cpp)
+
+  if(STATIC_UMAP_LINK)
+    set(umap-lib "umap-static")
+  else()
+    set(umap-lib "umap")
+  endif()
+
+  add_dependencies(${name} ${umap-lib})
+  target_link_libraries(${name} ${umap-lib})
+
+  include_directories( ${CMAKE_CURRENT_SOURCE_DIR} ${UMAPINCLUDEDIRS} )
+
+  install(TARGETS ${name}
+    LIBRARY DESTINATION lib
+    ARCHIVE DESTINATION lib/static
+    RUNTIME DESTINATION bin )
+
+  umap_check_run(${name} ${name})
+endfunction()
+
+#
+# umap_check_run(<program> <test> [VAR=value ...])
+#
+# Runs the check program <program> once more as the test <test>, with the
+# given environment.  A check that hangs fails after a minute.
+#
+function(umap_check_run program test)
+  add_test(NAME ${test}
+    COMMAND ${program} ${CMAKE_CURRENT_BINARY_DIR}/${test}.dat)
+
+  set_tests_properties(${test} PROPERTIES TIMEOUT 60)
+
+  if(ARGN)
+    set_tests_properties(${test} PROPERTIES ENVIRONMENT "${ARGN}")
+  endif()
+endfunction()
@@ -0,0 +1,117 @@
+//////////////////////////////////////////////////////////////////////////////
+// Copyright 2017-2020 Lawrence Livermore National Security, LLC and other
+// UMAP Project Developers. See the top-level LICENSE file for details.
+//
+// SPDX-License-Identifier: LGPL-2.1-only
+//////////////////////////////////////////////////////////////////////////////
+
+/*
+ * Checks that with UMAP_DIRTY_BACKGROUND_RATIO set, pages written to are
+ * written back to the store while they stay present, down to the ratio,
+ * and that writers held back by UMAP_DIRTY_RATIO still get all their
+ * writes through.
+ */
+#include <iostream>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "errno.h"
+#include "umap/umap.h"
+#include "../utility/check.hpp"
+
+static const uint64_t num_pages = 128;
+static const uint64_t buf_pages = 64;
+static const uint64_t written_pages = 32;
+
+//
+// 10% of the buffer
+//
+static const uint64_t background_pages = 6;
+
+static uint64_t
+count_written( int fd, uint64_t psize, uint64_t words_per_page )
+{
+  uint64_t n = 0;
+  uint64_t* page = new uint64_t[words_per_page];
+
+  for ( uint64_t p = 0; p < written_pages; ++p ) {
+    CHECK( pread(fd, page, psize, p * psize) == (ssize_t)psize );
+    n += page[0] == p * words_per_page + 1;
+  }
+  delete [] page;
+  return n;
+}
+
+int
+main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+    std::cerr << "Usage: " << argv[0] << " <file>\n";
+    return 1;
+  }
+
+  const char* filename = argv[1];
+
+  setenv("UMAP_BUFSIZE", std::to_string(buf_pages).c_str(), 1);
+  setenv("UMAP_DIRTY_BACKGROUND_RATIO", "10", 1);
+  setenv("UMAP_DIRTY_RATIO", "20", 1);
+  setenv("UMAP_READ_AHEAD", "1", 1);
+  unsetenv("UMAP_WP_ASYNC");
+
+  uint64_t psize = umapcfg_get_umap_page_size();
+  uint64_t length = num_pages * psize;
+  uint64_t words = length / sizeof(uint64_t);
+  uint64_t words_per_page = psize / sizeof(uint64_t);
+
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  CHECK( fd != -1 );
+  CHECK( ftruncate(fd, length) == 0 );
+
+  char* base = (char*)umap(NULL, length, PROT_READ|PROT_WRITE, UMAP_PRIVATE, fd, 0);
+  CHECK( base != UMAP_FAILED );
+  uint64_t* arr = (uint64_t*)base;
+
+  //
+  // More pages than UMAP_DIRTY_RATIO allows, but few enough that none are
+  // evicted, so only writeback can bring them to the file
+  //
+  for ( uint64_t i = 0; i < written_pages * words_per_page; ++i )
+    arr[i] = i + 1;
+
+  //
+  // The writeback thread looks at least once a second
+  //
+  uint64_t written = 0;
+  for ( int i = 0; i < 300; ++i ) {
+    written = count_written(fd, psize, words_per_page);
+    if ( written >= written_pages - background_pages )
+      break;
+    usleep(10000);
+  }
+  CHECK( written >= written_pages - background_pages );
+  CHECK( utility::count_resident(base, psize, written_pages) == written_pages );
+
+  //
+  // Then through the whole region, twice the size of the buffer
+  //
+  for ( uint64_t i = 0; i < words; ++i )
+    arr[i] = i + 2;
+
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( arr[i] == i + 2 );
+
+  CHECK( uunmap(base, length) == 0 );
+
+  uint64_t* out = new uint64_t[words];
+  CHECK( pread(fd, out, length, 0) == (ssize_t)length );
+  for ( uint64_t i = 0; i < words; ++i )
+    CHECK( out[i] == i + 2 );
+  delete [] out;
+
+  close(fd);
+  std::cout << "writeback: OK\n";
+  return 0;
+}